@@ -12,6 +12,14 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Each disk device's driver is in bdevsw[], so one device can be
+// a virtio disk and another the RAM disk.
+//
+// The log (log.c) doesn't write committed blocks home at once:
+// it marks their buffers dirty with bdirty(), which pins them
+// in the cache, and bflush() writes them later, in block order.
+// A block that many transactions change is written home once.
 
 
 #include "types.h"
@@ -23,32 +31,33 @@
 #include "fs.h"
 #include "buf.h"
 
+struct bdevsw bdevsw[NDISK];
+
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct kmem_cache *cache;
+  int nbuf;               // buffers allocated so far, at most NBUF
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
 } bcache;
 
+static void
+bufctor(void *p)
+{
+  initsleeplock(&((struct buf*)p)->lock, "buffer");
+}
+
 void
 binit(void)
 {
-  struct buf *b;
-
   initlock(&bcache.lock, "bcache");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf), bufctor, 0);
 
-  // Create linked list of buffers
+  // Buffers are allocated as bget() needs them.
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
 }
 
 // Look through buffer cache for block on device dev.
@@ -71,7 +80,30 @@ bget(uint dev, uint blockno)
     }
   }
 
-  // Not cached; recycle an unused buffer.
+  // Not cached; allocate a new buffer while under NBUF.
+  // Its data is a buddy block of its own, so it is aligned
+  // to BSIZE: a 4096-byte block is a whole page.
+  if(bcache.nbuf < NBUF && (b = kmem_cache_alloc(bcache.cache)) != 0){
+    if((b->data = bd_malloc(BSIZE)) != 0){
+      bcache.nbuf++;
+      b->next = bcache.head.next;
+      b->prev = &bcache.head;
+      bcache.head.next->prev = b;
+      bcache.head.next = b;
+      b->dev = dev;
+      b->blockno = blockno;
+      b->valid = 0;
+      b->disk = 0;
+      b->dirty = 0;
+      b->refcnt = 1;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      return b;
+    }
+    kmem_cache_free(bcache.cache, b);
+  }
+
+  // Otherwise recycle an unused buffer.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0) {
       b->dev = dev;
@@ -86,6 +118,15 @@ bget(uint dev, uint blockno)
   panic("bget: no buffers");
 }
 
+// Have b's device driver read or write it.
+static void
+brw(struct buf *b, int write)
+{
+  if(b->dev >= NDISK || bdevsw[b->dev].rw == 0)
+    panic("brw: no driver");
+  bdevsw[b->dev].rw(b->dev, b, write);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
@@ -94,7 +135,7 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b->dev, b, 0);
+    brw(b, 0);
     b->valid = 1;
   }
   return b;
@@ -106,7 +147,7 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b->dev, b, 1);
+  brw(b, 1);
 }
 
 // Release a locked buffer.
@@ -148,4 +189,70 @@ bunpin(struct buf *b) {
   release(&bcache.lock);
 }
 
+// The log has committed b, which log_write() pinned: it must
+// now be written home. b stays pinned until bflush() has
+// written it; a dirty buffer holds just one pin. Must be locked.
+void
+bdirty(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bdirty");
+  acquire(&bcache.lock);
+  if(b->dirty){
+    b->refcnt--;
+  } else {
+    b->dirty = 1;
+    b->dirtied = ticks;
+  }
+  release(&bcache.lock);
+}
+
+static int
+bbefore(struct buf *a, struct buf *b)
+{
+  return a->dev < b->dev || (a->dev == b->dev && a->blockno < b->blockno);
+}
+
+// Write home the buffers of device dev (every device if
+// dev < 0) that have been dirty for at least age ticks,
+// sorted by block number.
+void
+bflush(int dev, int age)
+{
+  struct buf *b, *list[NBUF];
+  int i, j, n;
+
+  n = 0;
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dirty && (dev < 0 || b->dev == dev) && ticks - b->dirtied >= age){
+      b->refcnt++;
+      list[n++] = b;
+    }
+  }
+  release(&bcache.lock);
+
+  for(i = 1; i < n; i++){
+    for(j = i; j > 0 && bbefore(list[j], list[j-1]); j--){
+      b = list[j];
+      list[j] = list[j-1];
+      list[j-1] = b;
+    }
+  }
+
+  for(i = 0; i < n; i++){
+    b = list[i];
+    acquiresleep(&b->lock);
+    // another bflush() may have written it meanwhile.
+    if(b->dirty){
+      bwrite(b);
+      acquire(&bcache.lock);
+      b->dirty = 0;
+      b->refcnt--;
+      release(&bcache.lock);
+    }
+    brelse(b);
+  }
+}
+
 
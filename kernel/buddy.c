@@ -6,64 +6,123 @@
 #include "defs.h"
 
 // Buddy allocator
+//
+// Each size k has a free list and two bitmaps, kept in 64-bit words:
+//
+// * alloc has one bit per buddy pair, the XOR of whether each of the
+//   two blocks is allocated (in use, or split) at size k. Allocating
+//   or freeing a block flips its pair's bit; if freeing leaves the
+//   bit clear, the buddy is free too and the two can merge.
+// * split has one bit per block, set if the block has been split.
+//
+// Bit k of nonempty is set when free list k is non-empty, so finding
+// the smallest free block that is big enough takes one ctz().
+//
+// Each CPU also keeps a few free blocks of each of the NSMALL
+// smallest sizes. Those blocks count as allocated in the bitmaps;
+// bd_malloc() and bd_free() hand them out and take them back with
+// interrupts off but without the global lock.
 
 static int nsizes;     // the number of entries in bd_sizes array
 
-#define LEAF_SIZE     16                         // The smallest block size
+#define LEAF_SHIFT    4
+#define LEAF_SIZE     (1 << LEAF_SHIFT)          // The smallest block size
 #define MAXSIZE       (nsizes-1)                 // Largest index in bd_sizes array
 #define BLK_SIZE(k)   ((1L << (k)) * LEAF_SIZE)  // Size of block at size k
 #define HEAP_SIZE     BLK_SIZE(MAXSIZE) 
 #define NBLK(k)       (1 << (MAXSIZE-k))         // Number of block at size k
 #define ROUNDUP(n,sz) (((((n)-1)/(sz))+1)*(sz))  // Round up to the next multiple of sz
 
+#define NSMALL        5    // sizes cached per CPU: 16 to 256 bytes
+#define NPCPU         16   // blocks cached per CPU and size
+
 typedef struct list Bd_list;
 
-// The allocator has sz_info for each size k. Each sz_info has a free
-// list, an array alloc to keep track which blocks have been
-// allocated, and an split array to to keep track which blocks have
-// been split.  The arrays are of type char (which is 1 byte), but the
-// allocator uses 1 bit per block (thus, one char records the info of
-// 8 blocks).
 struct sz_info {
   Bd_list free;
-  char *alloc;
-  char *split;
+  uint64 *alloc;
+  uint64 *split;
 };
 typedef struct sz_info Sz_info;
 
+struct bd_cpu {
+  int n[NSMALL];
+  void *blk[NSMALL][NPCPU];
+};
+
 static Sz_info *bd_sizes; 
 static void *bd_base;   // start address of memory managed by the buddy allocator
+static uint64 nonempty; // bit k set if bd_sizes[k].free is non-empty
 static struct spinlock lock;
+static struct bd_cpu bd_cpus[NCPU];
+
+// Number of trailing zero bits in x, which must not be 0.
+// (The kernel isn't linked with libgcc, so no __builtin_ctzl.)
+static inline int
+ctz(uint64 x)
+{
+  int n = 0;
+
+  if((x & 0xffffffff) == 0){ n += 32; x >>= 32; }
+  if((x & 0xffff) == 0){ n += 16; x >>= 16; }
+  if((x & 0xff) == 0){ n += 8; x >>= 8; }
+  if((x & 0xf) == 0){ n += 4; x >>= 4; }
+  if((x & 0x3) == 0){ n += 2; x >>= 2; }
+  if((x & 0x1) == 0) n += 1;
+  return n;
+}
+
+// Number of leading zero bits in x, which must not be 0.
+static inline int
+clz(uint64 x)
+{
+  int n = 0;
+
+  if((x >> 32) == 0){ n += 32; x <<= 32; }
+  if((x >> 48) == 0){ n += 16; x <<= 16; }
+  if((x >> 56) == 0){ n += 8; x <<= 8; }
+  if((x >> 60) == 0){ n += 4; x <<= 4; }
+  if((x >> 62) == 0){ n += 2; x <<= 2; }
+  if((x >> 63) == 0) n += 1;
+  return n;
+}
+
+#define BITWORD(i)  ((i) / 64)
+#define BITMASK(i)  (1UL << ((i) % 64))
 
 // Return 1 if bit at position index in array is set to 1
-int bit_isset(char *array, int index) {
-  char b = array[index/8];
-  char m = (1 << (index % 8));
-  return (b & m) == m;
+int bit_isset(uint64 *array, int index) {
+  return (array[BITWORD(index)] & BITMASK(index)) != 0;
 }
 
 // Set bit at position index in array to 1
-void bit_set(char *array, int index) {
-  char b = array[index/8];
-  char m = (1 << (index % 8));
-  array[index/8] = (b | m);
+void bit_set(uint64 *array, int index) {
+  array[BITWORD(index)] |= BITMASK(index);
 }
 
 // Clear bit at position index in array
-void bit_clear(char *array, int index) {
-  char b = array[index/8];
-  char m = (1 << (index % 8));
-  array[index/8] = (b & ~m);
+void bit_clear(uint64 *array, int index) {
+  array[BITWORD(index)] &= ~BITMASK(index);
+}
+
+// Flip bit at position index in array, and return its new value
+static inline int
+bit_flip(uint64 *array, int index) {
+  return ((array[BITWORD(index)] ^= BITMASK(index)) & BITMASK(index)) != 0;
 }
 
 // Print a bit vector as a list of ranges of 1 bits
 void
-bd_print_vector(char *vector, int len) {
+bd_print_vector(uint64 *vector, int len) {
   int last, lb;
   
   last = 1;
   lb = 0;
   for (int b = 0; b < len; b++) {
+    if (b % 64 == 0 && vector[BITWORD(b)] == (last ? ~0UL : 0)) {
+      b += 63;   // no change in this whole word
+      continue;
+    }
     if (last == bit_isset(vector, b))
       continue;
     if(last == 1)
@@ -83,8 +142,10 @@ bd_print() {
   for (int k = 0; k < nsizes; k++) {
     printf("size %d (blksz %d nblk %d): free list: ", k, BLK_SIZE(k), NBLK(k));
     lst_print(&bd_sizes[k].free);
-    printf("  alloc:");
-    bd_print_vector(bd_sizes[k].alloc, NBLK(k));
+    if(k < MAXSIZE) {
+      printf("  alloc pairs:");
+      bd_print_vector(bd_sizes[k].alloc, NBLK(k)/2);
+    }
     if(k > 0) {
       printf("  split:");
       bd_print_vector(bd_sizes[k].split, NBLK(k));
@@ -95,101 +156,166 @@ bd_print() {
 // What is the first k such that 2^k >= n?
 int
 firstk(uint64 n) {
-  int k = 0;
-  uint64 size = LEAF_SIZE;
-
-  while (size < n) {
-    k++;
-    size *= 2;
-  }
-  return k;
+  if (n <= LEAF_SIZE)
+    return 0;
+  return 64 - clz(n - 1) - LEAF_SHIFT;
 }
 
 // Compute the block index for address p at size k
 int
 blk_index(int k, char *p) {
-  int n = p - (char *) bd_base;
-  return n / BLK_SIZE(k);
+  return (uint64)(p - (char *) bd_base) >> (k + LEAF_SHIFT);
 }
 
 // Convert a block index at size k back into an address
 void *addr(int k, int bi) {
-  int n = bi * BLK_SIZE(k);
-  return (char *) bd_base + n;
+  return (char *) bd_base + ((uint64)bi << (k + LEAF_SHIFT));
 }
 
-// allocate nbytes, but malloc won't return anything smaller than LEAF_SIZE
-void *
-bd_malloc(uint64 nbytes)
+static void
+bd_push(int k, void *p)
+{
+  lst_push(&bd_sizes[k].free, p);
+  nonempty |= 1UL << k;
+}
+
+static void
+bd_remove(int k, void *p)
 {
-  int fk, k;
+  lst_remove(p);
+  if(lst_empty(&bd_sizes[k].free))
+    nonempty &= ~(1UL << k);
+}
 
-  acquire(&lock);
+// Take a block of size fk off the free lists, splitting a
+// bigger block if need be. Caller holds lock.
+static void *
+bd_alloc(int fk)
+{
+  uint64 m;
+  char *p;
+  int k;
 
   // Find a free block >= nbytes, starting with smallest k possible
-  fk = firstk(nbytes);
-  for (k = fk; k < nsizes; k++) {
-    if(!lst_empty(&bd_sizes[k].free))
-      break;
-  }
-  if(k >= nsizes) { // No free blocks?
-    release(&lock);
+  m = nonempty & ~((1UL << fk) - 1);
+  if(m == 0)
     return 0;
-  }
+  k = ctz(m);
 
   // Found a block; pop it and potentially split it.
-  char *p = lst_pop(&bd_sizes[k].free);
-  bit_set(bd_sizes[k].alloc, blk_index(k, p));
+  p = (char *) bd_sizes[k].free.next;
+  bd_remove(k, p);
+  if(k < MAXSIZE)
+    bit_flip(bd_sizes[k].alloc, blk_index(k, p) / 2);
   for(; k > fk; k--) {
     // split a block at size k and mark one half allocated at size k-1
     // and put the buddy on the free list at size k-1
     char *q = p + BLK_SIZE(k-1);   // p's buddy
     bit_set(bd_sizes[k].split, blk_index(k, p));
-    bit_set(bd_sizes[k-1].alloc, blk_index(k-1, p));
-    lst_push(&bd_sizes[k-1].free, q);
+    bit_flip(bd_sizes[k-1].alloc, blk_index(k-1, p) / 2);
+    bd_push(k-1, q);
   }
-  release(&lock);
+  return p;
+}
 
+// Put the block p of size k back on the free lists, merging
+// it with its buddy as far as possible. Caller holds lock.
+static void
+bd_release(void *p, int k)
+{
+  void *q;
+
+  for (; k < MAXSIZE; k++) {
+    int bi = blk_index(k, p);
+    int buddy = bi ^ 1;
+    // free p at size k; if the pair now differs, the buddy is
+    // allocated.
+    if (bit_flip(bd_sizes[k].alloc, bi / 2))
+      break;
+    // buddy is free; merge with buddy
+    q = addr(k, buddy);
+    bd_remove(k, q);    // remove buddy from free list
+    if(buddy % 2 == 0) {
+      p = q;
+    }
+    // at size k+1, mark that the merged buddy pair isn't split
+    // anymore
+    bit_clear(bd_sizes[k+1].split, blk_index(k+1, p));
+  }
+  bd_push(k, p);
+}
+
+// allocate nbytes, but malloc won't return anything smaller than LEAF_SIZE
+void *
+bd_malloc(uint64 nbytes)
+{
+  struct bd_cpu *c;
+  void *p;
+  int k;
+
+  k = firstk(nbytes);
+  if(k >= nsizes)
+    return 0;
+
+  if(k < NSMALL) {
+    push_off();
+    c = &bd_cpus[cpuid()];
+    if(c->n[k] == 0) {
+      // refill half the cache under one acquire
+      acquire(&lock);
+      while(c->n[k] < NPCPU/2 && (p = bd_alloc(k)) != 0)
+        c->blk[k][c->n[k]++] = p;
+      release(&lock);
+    }
+    p = c->n[k] > 0 ? c->blk[k][--c->n[k]] : 0;
+    pop_off();
+    return p;
+  }
+
+  acquire(&lock);
+  p = bd_alloc(k);
+  release(&lock);
   return p;
 }
 
 // Find the size of the block that p points to.
+// p's ancestors stay split while p is allocated, so this
+// doesn't need the lock.
 int
 size(char *p) {
-  for (int k = 0; k < nsizes; k++) {
+  for (int k = 0; k < MAXSIZE; k++) {
     if(bit_isset(bd_sizes[k+1].split, blk_index(k+1, p))) {
       return k;
     }
   }
-  return 0;
+  return MAXSIZE;
 }
 
 // Free memory pointed to by p, which was earlier allocated using
 // bd_malloc.
 void
 bd_free(void *p) {
-  void *q;
+  struct bd_cpu *c;
   int k;
 
-  acquire(&lock);
-  for (k = size(p); k < MAXSIZE; k++) {
-    int bi = blk_index(k, p);
-    int buddy = (bi % 2 == 0) ? bi+1 : bi-1;
-    bit_clear(bd_sizes[k].alloc, bi);  // free p at size k
-    if (bit_isset(bd_sizes[k].alloc, buddy)) {  // is buddy allocated?
-      break;   // break out of loop
+  k = size(p);
+  if(k < NSMALL) {
+    push_off();
+    c = &bd_cpus[cpuid()];
+    if(c->n[k] == NPCPU) {
+      // give back half the cache under one acquire
+      acquire(&lock);
+      while(c->n[k] > NPCPU/2)
+        bd_release(c->blk[k][--c->n[k]], k);
+      release(&lock);
     }
-    // budy is free; merge with buddy
-    q = addr(k, buddy);
-    lst_remove(q);    // remove buddy from free list
-    if(buddy % 2 == 0) {
-      p = q;
-    }
-    // at size k+1, mark that the merged buddy pair isn't split
-    // anymore
-    bit_clear(bd_sizes[k+1].split, blk_index(k+1, p));
+    c->blk[k][c->n[k]++] = p;
+    pop_off();
+    return;
   }
-  lst_push(&bd_sizes[k].free, p);
+
+  acquire(&lock);
+  bd_release(p, k);
   release(&lock);
 }
 
@@ -204,15 +330,12 @@ blk_index_next(int k, char *p) {
 
 int
 log2(uint64 n) {
-  int k = 0;
-  while (n > 1) {
-    k++;
-    n = n >> 1;
-  }
-  return k;
+  return n == 0 ? 0 : 63 - clz(n);
 }
 
-// Mark memory from [start, stop), starting at size 0, as allocated. 
+// Mark memory from [start, stop), starting at size 1, as split,
+// so that size() sees the blocks next to it as split off.
+// The alloc bits are set by bd_initfree().
 void
 bd_mark(void *start, void *stop)
 {
@@ -221,32 +344,39 @@ bd_mark(void *start, void *stop)
   if (((uint64) start % LEAF_SIZE != 0) || ((uint64) stop % LEAF_SIZE != 0))
     panic("bd_mark");
 
-  for (int k = 0; k < nsizes; k++) {
+  for (int k = 1; k < nsizes; k++) {
     bi = blk_index(k, start);
     bj = blk_index_next(k, stop);
     for(; bi < bj; bi++) {
-      if(k > 0) {
-        // if a block is allocated at size k, mark it as split too.
-        bit_set(bd_sizes[k].split, bi);
-      }
-      bit_set(bd_sizes[k].alloc, bi);
+      bit_set(bd_sizes[k].split, bi);
     }
   }
 }
 
-// If a block is marked as allocated and the buddy is free, put the
-// buddy on the free list at size k.
+// Does block bi at size k overlap memory outside [left, right),
+// i.e. memory marked as allocated?
+static int
+bd_used(int k, int bi, char *left, char *right)
+{
+  char *b = addr(k, bi);
+  return b < left || b + BLK_SIZE(k) > right;
+}
+
+// If one block of bi's pair is allocated and the other is
+// free, put the free one on the free list at size k.
 int
-bd_initfree_pair(int k, int bi) {
-  int buddy = (bi % 2 == 0) ? bi+1 : bi-1;
+bd_initfree_pair(int k, int bi, void *left, void *right) {
+  int buddy = bi ^ 1;
   int free = 0;
-  if(bit_isset(bd_sizes[k].alloc, bi) !=  bit_isset(bd_sizes[k].alloc, buddy)) {
+  int used = bd_used(k, bi, left, right);
+  if(used != bd_used(k, buddy, left, right)) {
     // one of the pair is free
     free = BLK_SIZE(k);
-    if(bit_isset(bd_sizes[k].alloc, bi))
-      lst_push(&bd_sizes[k].free, addr(k, buddy));   // put buddy on free list
+    bit_set(bd_sizes[k].alloc, bi / 2);
+    if(used)
+      bd_push(k, addr(k, buddy));   // put buddy on free list
     else
-      lst_push(&bd_sizes[k].free, addr(k, bi));      // put bi on free list
+      bd_push(k, addr(k, bi));      // put bi on free list
   }
   return free;
 }
@@ -261,10 +391,12 @@ bd_initfree(void *bd_left, void *bd_right) {
   for (int k = 0; k < MAXSIZE; k++) {   // skip max size
     int left = blk_index_next(k, bd_left);
     int right = blk_index(k, bd_right);
-    free += bd_initfree_pair(k, left);
-    if(right <= left)
+    if(left >= NBLK(k))
       continue;
-    free += bd_initfree_pair(k, right);
+    free += bd_initfree_pair(k, left, bd_left, bd_right);
+    if(right/2 <= left/2 || right >= NBLK(k))
+      continue;
+    free += bd_initfree_pair(k, right, bd_left, bd_right);
   }
   return free;
 }
@@ -314,20 +446,22 @@ bd_init(void *base, void *end) {
   p += sizeof(Sz_info) * nsizes;
   memset(bd_sizes, 0, sizeof(Sz_info) * nsizes);
 
-  // initialize free list and allocate the alloc array for each size k
-  for (int k = 0; k < nsizes; k++) {
+  // initialize free list and allocate the alloc array for each size k,
+  // one bit per pair, except for the largest size, which has no pairs.
+  for (int k = 0; k < MAXSIZE; k++) {
     lst_init(&bd_sizes[k].free);
-    sz = sizeof(char)* ROUNDUP(NBLK(k), 8)/8;
-    bd_sizes[k].alloc = p;
+    sz = ROUNDUP(NBLK(k)/2, 64)/8;
+    bd_sizes[k].alloc = (uint64 *) p;
     memset(bd_sizes[k].alloc, 0, sz);
     p += sz;
   }
+  lst_init(&bd_sizes[MAXSIZE].free);
 
   // allocate the split array for each size k, except for k = 0, since
   // we will not split blocks of size k = 0, the smallest size.
   for (int k = 1; k < nsizes; k++) {
-    sz = sizeof(char)* (ROUNDUP(NBLK(k), 8))/8;
-    bd_sizes[k].split = p;
+    sz = ROUNDUP(NBLK(k), 64)/8;
+    bd_sizes[k].split = (uint64 *) p;
     memset(bd_sizes[k].split, 0, sz);
     p += sz;
   }
@@ -352,3 +486,30 @@ bd_init(void *base, void *end) {
   }
 }
 
+
+#define BDBATCH 32
+
+// bdbench(nbytes, n): n bd_malloc()s of nbytes, each batch of
+// BDBATCH freed again before the next, so that blocks really are
+// split and merged. Returns the number of successful bd_malloc()s.
+// Used by user/bdbench.c to measure throughput.
+uint64
+sys_bdbench(void)
+{
+  void *blk[BDBATCH];
+  int nbytes, n, i, j, got, tot;
+
+  if(argint(0, &nbytes) < 0 || argint(1, &n) < 0 || nbytes <= 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < n; i += BDBATCH) {
+    for(got = 0; got < BDBATCH && i + got < n; got++) {
+      if((blk[got] = bd_malloc(nbytes)) == 0)
+        break;
+    }
+    for(j = 0; j < got; j++)
+      bd_free(blk[j]);
+    tot += got;
+  }
+  return tot;
+}
@@ -1,12 +1,24 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int dirty;   // committed to the log, not yet written home?
+  uint dirtied; // ticks when it became dirty
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes, aligned to BSIZE
 };
 
+// map disk device number to its driver, which reads
+// (write == 0) or writes buf b of device n, and returns
+// once the transfer is done. Drivers set their entries
+// when they are initialized.
+struct bdevsw {
+  void (*rw)(int n, struct buf *b, int write);
+};
+
+extern struct bdevsw bdevsw[];
+
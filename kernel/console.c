@@ -17,6 +17,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "poll.h"
+#include "fcntl.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
@@ -55,26 +57,38 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct pollq pollq;  // poll() calls waiting for input
 } cons;
 
 //
 // user write()s to the console go here.
+// they go to the uart's output buffer a chunk at
+// a time, and wait only while it is full; an
+// O_NONBLOCK write stops there instead.
 //
 int
 consolewrite(struct file *f, int user_src, uint64 src, int n)
 {
-  int i;
-
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  char buf[64];
+  int i, m, k;
+  int nonblock = filenonblock(f);
+
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    consputc(c);
+    if((k = uartwrite(buf, m, nonblock)) < m){
+      i += k;
+      break;
+    }
   }
-  release(&cons.lock);
 
-  return n;
+  if(i == 0 && n > 0 && nonblock)
+    return EAGAIN;
+  return i;
 }
 
 //
@@ -100,6 +114,10 @@ consoleread(struct file *f, int user_dst, uint64 dst, int n)
         release(&cons.lock);
         return -1;
       }
+      if(filenonblock(f)){
+        release(&cons.lock);
+        return n < target ? target - n : EAGAIN;
+      }
       sleep(&cons.r, &cons.lock);
     }
 
@@ -133,6 +151,25 @@ consoleread(struct file *f, int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() on the console: readable once a whole line
+// (or end-of-file) has arrived; always writable.
+//
+int
+consolepoll(struct file *f, struct pollent *e)
+{
+  int r;
+
+  if(e)
+    pollqueue(&cons.pollq, e);
+  acquire(&cons.lock);
+  r = POLLOUT;
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -177,6 +214,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup(&cons.pollq);
       }
     }
     break;
@@ -195,5 +233,6 @@ consoleinit(void)
   // connect read and write system calls
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   devsw[CONSOLE].write = consolewrite;
 }
@@ -2,12 +2,19 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct kmem_cache;
 struct pipe;
+struct pollent;
+struct pollfd;
+struct pollq;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct tgroup;
+struct work;
 
 // bio.c
 void            binit(void);
@@ -16,6 +23,8 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bdirty(struct buf*);
+void            bflush(int, int);
 
 // console.c
 void            consoleinit(void);
@@ -29,10 +38,22 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+int             filenonblock(struct file*);
+void            filesetnonblock(struct file*, int);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepread(struct file*, uint64, int, uint);
+int             filepwrite(struct file*, uint64, int, uint);
+int             fileseek(struct file*, int, int);
+int             filesync(struct file*);
+int             filesplice(struct file*, struct file*, int);
+int             filetee(struct file*, struct file*, int);
+int             filecopy(struct file*, struct file*, int);
+int             filepoll(struct file*, struct pollent*);
 
 // fs.c
 void            fsinit(int);
@@ -52,43 +73,64 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             copyi(struct inode*, uint, struct inode*, uint, uint);
 
 // ramdisk.c
-void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+void            ramdiskinit(int);
+void            ramdiskrw(int, struct buf*, int);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kzalloc(void);
 void            kfree(void *);
 void            kinit();
+void*           kalloc_super(void);
+void            kfree_super(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(int);
 void            end_op(int);
+void            log_sync(int, int);
+void            logtick(void);
 void            crash_op(int,int);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipegetsize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
+char*           pipewbegin(struct pipe*, int*);
+void            pipewend(struct pipe*, int);
+char*           piperbegin(struct pipe*, int, int*, int);
+void            piperend(struct pipe*, int);
+int             pipewrite(struct pipe*, uint64, int, int);
+int             pipepoll(struct pipe*, int, struct pollent*);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
+void            klog(int, char*, ...);
+void            klogflush(void);
+int             klogread(uint64, int);
 
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             growproc(int, int*);
+int             tgsolo(void);
+int             clone(uint64, uint64, uint64);
+void            texit(int);
+int             join(int, uint64);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             kthread_create(void (*)(void*), void*, char*);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -100,16 +142,41 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// work.c
+void            workinit(void);
+void            workstart(void);
+void            initwork(struct work*, int, void (*)(void*), void*);
+int             queue_work(struct work*);
+int             queue_work_on(int, struct work*);
+int             workcpu(uint);
+int             systemwork(void);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// rvv.c
+#ifdef RVV
+extern int      rvv_present;
+void*           rvv_memmove(void*, const void*, uint);
+void*           rvv_memset(void*, int, uint);
+int             rvv_memcmp(const void*, const void*, uint);
+int             rvv_strlen(const char*);
+#endif
+
+// slab.c
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*), void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
+void            freelock(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
@@ -132,6 +199,14 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// sysfile.c
+int             fileopen(char*, int);
+
+// uring.c
+uint64          uringsetup(void);
+int             uringenter(int);
+void            uringstop(struct tgroup*);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -140,17 +215,41 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// poll.c
+void            pollinit(void);
+void            pollqueue(struct pollq*, struct pollent*);
+void            pollwakeup(struct pollq*);
+void            polltick(void);
+int             poll(struct file**, struct pollfd*, int, int);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            ipi(int);
+
+// textcache.c
+void            textinit(void);
+uint64          textget(struct inode*, uint, uint);
+void            textdup(uint64);
+void            textput(uint64);
+void            textinval(uint, uint);
+int             textcached(uint, uint);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+int             uartwrite(char*, int, int);
+void            uartflush(void);
+void            uartputc_sync(int);
 int             uartgetc(void);
 
 // vm.c
@@ -167,6 +266,14 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+uint64          uvmsatp(struct proc*);
+void            uvmflush(struct proc*, uint64, uint64);
+void            uvmshootdown(struct proc*);
+void            uvmrevoke(pagetable_t, uint64, uint64);
+int             uvmfault(struct proc*, uint64, int);
+uint64          uvmget(pagetable_t, uint64, int, struct tgroup**);
+void            uvmput(struct tgroup*);
+void            uvmprefault(struct proc*, uint64, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
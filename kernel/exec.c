@@ -3,23 +3,24 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
-
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint64 argc, sz, sp, ustack[MAXARG+1], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *execip = 0, *oldip;
   struct proghdr ph;
+  struct seg seg[NSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
 
   begin_op(ROOTDEV);
 
@@ -38,8 +39,11 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments. uvmfault() reads each
+  // page from ip when the program first touches it, so
+  // keep a reference to ip for as long as the image lives.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -47,26 +51,38 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz >= USERTOP)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg == NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].fileend = ph.vaddr + ph.filesz;
+    seg[nseg].end = ph.vaddr + ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].perm = 0;
+    if(ph.flags & ELF_PROG_FLAG_READ)
+      seg[nseg].perm |= PTE_R;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      seg[nseg].perm |= PTE_W;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      seg[nseg].perm |= PTE_X;
+    nseg++;
+    sz = PGROUNDUP(ph.vaddr + ph.memsz);
   }
-  iunlockput(ip);
+  iunlock(ip);
   end_op(ROOTDEV);
+  execip = ip;
   ip = 0;
 
   p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = tg->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
-  if((sz = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
+  if(sz + 2*PGSIZE > USERTOP || (sz = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
   uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
@@ -94,6 +110,12 @@ exec(char *path, char **argv)
   if(copyout(pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
     goto bad;
 
+  // the process's other threads would lose their memory:
+  // from here on, it has only this one. ring work uses the
+  // old image's memory and files too; tgsolo() stops it.
+  if(tgsolo() < 0)
+    goto bad;
+
   // arguments to user main(argc, argv)
   // argc is returned via the system call return
   // value, which goes in a0.
@@ -106,12 +128,23 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
-  oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+  oldpagetable = tg->pagetable;
+  oldip = tg->execip;
+  tg->pagetable = p->pagetable = pagetable;
+  tg->execip = execip;
+  memmove(tg->seg, seg, sizeof(seg));
+  tg->nseg = nseg;
+  tg->uring = 0;           // unmapped with oldpagetable
+  tg->asidgen = 0;         // the old ASID's TLB entries are for oldpagetable
+  tg->sz = sz;
   p->tf->epc = elf.entry;  // initial program counter = main
   p->tf->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldip){
+    begin_op(ROOTDEV);
+    iput(oldip);
+    end_op(ROOTDEV);
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -122,33 +155,10 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op(ROOTDEV);
   }
-  return -1;
-}
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  if(execip){
+    begin_op(ROOTDEV);
+    iput(execip);
+    end_op(ROOTDEV);
   }
-  
-  return 0;
+  return -1;
 }
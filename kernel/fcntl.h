@@ -2,3 +2,20 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x800
+
+// read() and write() on an O_NONBLOCK pipe or console
+// return EAGAIN, rather than waiting, if they can't
+// move any bytes.
+#define EAGAIN    (-2)
+
+// lseek() whence
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // size of a pipe's buffer
+#define F_SETPIPE_SZ 2  // resize a pipe's buffer; returns the new size
+#define F_GETFL      3  // the O_ flags of the open file
+#define F_SETFL      4  // set the open file's O_NONBLOCK
@@ -10,19 +10,23 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "uio.h"
+#include "fcntl.h"
 #include "stat.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;   // protects f->ref
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file), 0, 0);
 }
 
 // Allocate a file structure.
@@ -31,16 +35,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +71,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -82,6 +82,21 @@ fileclose(struct file *f)
   }
 }
 
+// Is O_NONBLOCK set on f? fcntl(F_SETFL) may change it
+// at any time, from any process that shares f, so f->nonblock
+// is read and written only with atomic loads and stores.
+int
+filenonblock(struct file *f)
+{
+  return __atomic_load_n(&f->nonblock, __ATOMIC_RELAXED);
+}
+
+void
+filesetnonblock(struct file *f, int nonblock)
+{
+  __atomic_store_n(&f->nonblock, nonblock != 0, __ATOMIC_RELAXED);
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int
@@ -101,27 +116,101 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read the cnt segments of iov from inode ip at *off,
+// all with ip locked once, advancing *off. Stops at
+// end of file.
+static int
+inoderead(struct inode *ip, uint *off, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  tot = 0;
+  ilock(ip);
+  for(i = 0; i < cnt; i++){
+    if((r = readi(ip, 1, (uint64)iov[i].base, *off, iov[i].len)) > 0){
+      *off += r;
+      tot += r;
+    }
+    if(r != iov[i].len)
+      break;
+  }
+  iunlock(ip);
+  return tot;
+}
+
+// Write the cnt segments of iov to inode ip at *off, packing
+// as many bytes into each log transaction (and ilock hold) as
+// it can take, advancing *off. Returns the total, or -1 if a
+// write fails.
+static int
+inodewrite(struct inode *ip, uint *off, struct iovec *iov, int cnt)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // the segments go to consecutive offsets, so they
+  // need no more slop than a single write.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i, segoff, n1, r, room;
+
+  i = 0;    // segment
+  segoff = 0;  // bytes of it written
+  r = 0;
+  while(i < cnt && r >= 0){
+    begin_op(ip->dev);
+    ilock(ip);
+    for(room = max; i < cnt && room > 0; ){
+      n1 = iov[i].len - segoff;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(ip, 1, (uint64)iov[i].base + segoff, *off, n1)) < 0)
+        break;
+      if(r != n1)
+        panic("short filewrite");
+      *off += r;
+      room -= r;
+      if((segoff += r) == iov[i].len){
+        i++;
+        segoff = 0;
+      }
+    }
+    iunlock(ip);
+    end_op(ip->dev);
+  }
+  if(r < 0)
+    return -1;
+  for(r = 0, i = 0; i < cnt; i++)
+    r += iov[i].len;
+  return r;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
+  struct iovec iov;
+
   int r = 0;
 
   if(f->readable == 0)
     return -1;
 
+  // fault in the buffer now, since pipes and devices copy
+  // to it with spinlocks held, and readi() with ip locked.
+  uvmprefault(myproc(), addr, n);
+
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, addr, n, filenonblock(f));
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
     r = devsw[f->major].read(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    iov.base = (void*)addr;
+    iov.len = n;
+    r = inoderead(f->ip, &f->off, &iov, 1);
   } else {
     panic("fileread");
   }
@@ -129,50 +218,76 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Read the cnt segments of iov from file f, in order.
+// A pipe or device read stops after a segment it
+// doesn't fill, rather than wait for more.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE){
+    for(i = 0; i < cnt; i++)
+      uvmprefault(myproc(), (uint64)iov[i].base, iov[i].len);
+    return inoderead(f->ip, &f->off, iov, cnt);
+  }
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if((r = fileread(f, (uint64)iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : r;
+    tot += r;
+    if(r != iov[i].len)
+      break;
+  }
+  return tot;
+}
+
+// The poll() events ready on file f. If e isn't 0, first put
+// it on the wait queue of f's pipe or device, if f has one.
+int
+filepoll(struct file *f, struct pollent *e)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, e);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV && devsw[f->major].poll)
+    r = devsw[f->major].poll(f, e);
+  else
+    r = POLLIN | POLLOUT;    // files never block.
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
+  // as in fileread().
+  uvmprefault(myproc(), addr, n);
+
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, addr, n, filenonblock(f));
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
     ret = devsw[f->major].write(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op(f->ip->dev);
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op(f->ip->dev);
-
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    iov.base = (void*)addr;
+    iov.len = n;
+    ret = inodewrite(f->ip, &f->off, &iov, 1);
   } else {
     panic("filewrite");
   }
@@ -180,3 +295,268 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write the cnt segments of iov to file f, in order.
+// A pipe or device write stops after a short write.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_INODE){
+    for(i = 0; i < cnt; i++)
+      uvmprefault(myproc(), (uint64)iov[i].base, iov[i].len);
+    return inodewrite(f->ip, &f->off, iov, cnt);
+  }
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if((r = filewrite(f, (uint64)iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : r;
+    tot += r;
+    if(r != iov[i].len)
+      break;
+  }
+  return tot;
+}
+
+// Read n bytes of inode file f at off, leaving f->off alone.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  uvmprefault(myproc(), addr, n);
+  iov.base = (void*)addr;
+  iov.len = n;
+  return inoderead(f->ip, &off, &iov, 1);
+}
+
+// Write n bytes to inode file f at off, leaving f->off alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  uvmprefault(myproc(), addr, n);
+  iov.base = (void*)addr;
+  iov.len = n;
+  return inodewrite(f->ip, &off, &iov, 1);
+}
+
+// Make what has been written to inode file f durable,
+// for fsync().
+int
+filesync(struct file *f)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  log_sync(f->ip->dev, 0);
+  return 0;
+}
+
+// Move f's offset to off, from the start of the file,
+// the current offset or the end as whence says. The
+// offset can't go past the end, since files have no
+// holes. Returns the new offset.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_CUR)
+    off += f->off;
+  else if(whence == SEEK_END)
+    off += f->ip->size;
+  else if(whence != SEEK_SET)
+    off = -1;
+  if(off < 0 || off > f->ip->size){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = off;
+  iunlock(f->ip);
+  return off;
+}
+
+
+// Copy up to n bytes from inode file f into pipe pi's ring.
+static int
+file2pipe(struct file *f, struct pipe *pi, int n)
+{
+  char *p;
+  int m, r, tot;
+
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if((p = pipewbegin(pi, &m)) == 0)
+      return tot > 0 ? tot : -1;
+    ilock(f->ip);
+    if((r = readi(f->ip, 0, (uint64)p, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    pipewend(pi, r > 0 ? r : 0);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m)      // end of file
+      return tot + r;
+  }
+  return tot;
+}
+
+// Copy up to n bytes out of pipe pi's ring into inode file f.
+// Waits for the pipe to have some data, but not for more.
+static int
+pipe2file(struct pipe *pi, struct file *f, int n)
+{
+  // as in filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  char *p;
+  int m, r, tot;
+
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if(m > max)
+      m = max;
+    if((p = piperbegin(pi, 0, &m, tot == 0)) == 0)
+      return tot > 0 ? tot : -1;
+    if(m == 0){
+      piperend(pi, 0);
+      break;
+    }
+    begin_op(f->ip->dev);
+    ilock(f->ip);
+    if((r = writei(f->ip, 0, (uint64)p, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    end_op(f->ip->dev);
+    piperend(pi, r > 0 ? r : 0);
+    if(r != m)
+      return tot > 0 ? tot : -1;
+  }
+  return tot;
+}
+
+// Copy up to n bytes from pipe in's ring into pipe out's,
+// consuming them from in if consume is set. Waits for in
+// to have some data, but not for more.
+static int
+pipe2pipe(struct pipe *in, struct pipe *out, int n, int consume)
+{
+  char *src, *dst;
+  int m, tot;
+
+  if(in == out)
+    return -1;
+  for(tot = 0; tot < n; tot += m){
+    m = n - tot;
+    if((src = piperbegin(in, consume ? 0 : tot, &m, tot == 0)) == 0)
+      return tot > 0 ? tot : -1;
+    if(m == 0){
+      piperend(in, 0);
+      break;
+    }
+    if((dst = pipewbegin(out, &m)) == 0){
+      piperend(in, 0);
+      return tot > 0 ? tot : -1;
+    }
+    memmove(dst, src, m);
+    pipewend(out, m);
+    piperend(in, consume ? m : 0);
+  }
+  return tot;
+}
+
+// Move up to n bytes from in to out within the kernel, for
+// splice(). One of them must be a pipe; the other may be a
+// pipe or an inode file. File data goes between the buffer
+// cache and the pipe's ring with one copy.
+// Returns the number of bytes moved, 0 at end of file, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_PIPE && out->type == FD_PIPE)
+    return pipe2pipe(in->pipe, out->pipe, n, 1);
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return file2pipe(in, out->pipe, n);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return pipe2file(in->pipe, out, n);
+  return -1;
+}
+
+// Copy up to n bytes from inode file in to inode file out,
+// at and advancing their offsets, for copy_file_range().
+// Data goes from in's buffers to out's with one copy.
+// Returns the number of bytes copied, 0 at end of file, or -1.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+  // as in filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *a, *b;
+  int m, r, tot;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_INODE || out->type != FD_INODE || in->ip == out->ip)
+    return -1;
+
+  // refuse a directory: unlink() and create() lock a
+  // directory before its files, not in the order below.
+  // (out can't be one; open() won't make it writable.)
+  // a file stays a file while we hold a reference.
+  ilock(in->ip);
+  r = in->ip->type == T_DIR;
+  iunlock(in->ip);
+  if(r)
+    return -1;
+
+  // lock the two inodes in a fixed order, so that
+  // copies between them in opposite directions
+  // can't deadlock.
+  a = in->ip;
+  b = out->ip;
+  if(a->dev > b->dev || (a->dev == b->dev && a->inum > b->inum)){
+    a = out->ip;
+    b = in->ip;
+  }
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if(m > max)
+      m = max;
+    begin_op(out->ip->dev);
+    ilock(a);
+    ilock(b);
+    if((r = copyi(out->ip, out->off, in->ip, in->off, m)) > 0){
+      in->off += r;
+      out->off += r;
+    }
+    iunlock(b);
+    iunlock(a);
+    end_op(out->ip->dev);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m)      // end of file
+      return tot + r;
+  }
+  return tot;
+}
+
+// Copy up to n bytes from pipe in to pipe out without
+// consuming them from in, for tee().
+int
+filetee(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_PIPE || out->type != FD_PIPE)
+    return -1;
+  return pipe2pipe(in->pipe, out->pipe, n, 0);
+}
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK: return EAGAIN instead of waiting
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE and FD_DEVICE
@@ -19,8 +20,11 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *prev; // icache list
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int text;           // may have pages in the text cache?
 
   short type;         // copy of disk inode
   short major;
@@ -30,10 +34,24 @@ struct inode {
   uint addrs[NDIRECT+1];
 };
 
+// a wait queue of poll() calls (poll.c), in a pipe or device.
+struct pollq {
+  struct pollent *first;
+};
+
+struct pollent {
+  struct pollwait *w;     // the poll() call
+  struct pollq *q;        // the queue this is on
+  struct pollent *next;
+};
+
 // map major device number to device functions.
+// poll, if set, returns the poll() events that are ready,
+// after putting the pollent, if any, on the device's pollq.
 struct devsw {
   int (*read)(struct file *, int, uint64, int);
   int (*write)(struct file *, int, uint64, int);
+  int (*poll)(struct file *, struct pollent *);
 };
 
 extern struct devsw devsw[];
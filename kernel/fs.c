@@ -15,8 +15,8 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -44,6 +44,8 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.bsize != BSIZE)
+    panic("fsinit: block size");
   initlog(dev, &sb);
 }
 
@@ -61,17 +63,24 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block: the first free one after
+// near, wrapping around, so that a file's blocks tend to
+// be contiguous on disk.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint near)
 {
-  int b, bi, m;
+  int b, bi, m, n;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  if(near >= sb.size)
+    near = 0;
+  b = near - near % BPB;
+  bi = near % BPB;
+  // visit near's bitmap block again at the end,
+  // for the bits before near.
+  for(n = 0; n <= (sb.size + BPB - 1) / BPB; n++){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    for(; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
@@ -82,6 +91,9 @@ balloc(uint dev)
       }
     }
     brelse(bp);
+    if((b += BPB) >= sb.size)
+      b = 0;
+    bi = 0;
   }
   panic("balloc: out of blocks");
 }
@@ -128,18 +140,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+// * Referencing in cache: an entry is in the inode cache
+//   while ip->ref is non-zero, and ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. An entry whose ref reaches zero may
+//   stay cached, but only iget() can take it up again.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees an inode with no links.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -163,10 +176,17 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
+// The icache.lock spin-lock protects the list of icache
+// entries. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
+// Entries come from a slab cache (slab.c), so their sleep-locks
+// are initialized once per object rather than on every iget().
+// iput() keeps up to NIUNUSED valid entries with ip->ref == 0,
+// most recently used first on the list, so that the next iget()
+// of the file needn't read its inode from disk again; iget()
+// recycles the least recently used one when the slab cache is
+// out of memory.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -174,18 +194,30 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode head;      // list of cached inodes, by recent use
+  int nunused;            // entries with ref == 0
 } icache;
 
+static void
+inodector(void *p)
+{
+  initsleeplock(&((struct inode*)p)->lock, "inode");
+}
+
+static void
+inodedtor(void *p)
+{
+  freelock(&((struct inode*)p)->lock.lk);
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode), inodector, inodedtor);
+  icache.head.prev = &icache.head;
+  icache.head.next = &icache.head;
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -243,27 +275,35 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.head.next; ip != &icache.head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        icache.nunused--;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Allocate an inode cache entry, or recycle the least
+  // recently used unreferenced one.
+  if((ip = kmem_cache_alloc(icache.cache)) != 0){
+    ip->next = icache.head.next;
+    ip->prev = &icache.head;
+    icache.head.next->prev = ip;
+    icache.head.next = ip;
+  } else {
+    for(ip = icache.head.prev; ip != &icache.head; ip = ip->prev)
+      if(ip->ref == 0)
+        break;
+    if(ip == &icache.head)
+      panic("iget: no inodes");
+    icache.nunused--;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -308,11 +348,24 @@ ilock(struct inode *ip)
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
+    ip->text = textcached(ip->dev, ip->inum);
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
+// Don't let exec() find stale pages of ip's program
+// once ip changes. Most files have never been run, and
+// skip the text cache. Caller holds ip->lock.
+static void
+itextinval(struct inode *ip)
+{
+  if(ip->text){
+    textinval(ip->dev, ip->inum);
+    ip->text = 0;
+  }
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -323,9 +376,28 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Free the least recently used unreferenced inode cache
+// entry. Caller holds icache.lock.
+static void
+ievict(void)
+{
+  struct inode *ip;
+
+  for(ip = icache.head.prev; ip != &icache.head; ip = ip->prev){
+    if(ip->ref == 0){
+      ip->next->prev = ip->prev;
+      ip->prev->next = ip->next;
+      icache.nunused--;
+      kmem_cache_free(icache.cache, ip);
+      return;
+    }
+  }
+}
+
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry stays
+// cached, unless it is no longer valid, or that would make
+// more than NIUNUSED unreferenced entries.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -354,7 +426,20 @@ iput(struct inode *ip)
     acquire(&icache.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    ip->next->prev = ip->prev;
+    ip->prev->next = ip->next;
+    if(!ip->valid){
+      kmem_cache_free(icache.cache, ip);
+    } else {
+      ip->next = icache.head.next;
+      ip->prev = &icache.head;
+      icache.head.next->prev = ip;
+      icache.head.next = ip;
+      if(++icache.nunused > NIUNUSED)
+        ievict();
+    }
+  }
   release(&icache.lock);
 }
 
@@ -374,7 +459,8 @@ iunlockput(struct inode *ip)
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, next to the
+// block before it if it can.
 static uint
 bmap(struct inode *ip, uint bn)
 {
@@ -383,7 +469,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, bn > 0 ? ip->addrs[bn-1] : 0);
     return addr;
   }
   bn -= NDIRECT;
@@ -391,11 +477,11 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, ip->addrs[NDIRECT-1]);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = balloc(ip->dev, bn > 0 ? a[bn-1] : ip->addrs[NDIRECT]);
       log_write(bp);
     }
     brelse(bp);
@@ -417,6 +503,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  itextinval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -494,6 +582,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  itextinval(ip);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -517,6 +607,45 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return n;
 }
 
+// Copy n bytes of src at soff to dst at doff, straight
+// from src's buffers to dst's. Caller holds both locks,
+// and has begun a transaction on dst's device.
+// Returns the number of bytes copied, fewer at the end
+// of src, or -1.
+int
+copyi(struct inode *dst, uint doff, struct inode *src, uint soff, uint n)
+{
+  uint tot, m;
+  struct buf *sbp, *dbp;
+
+  if(soff > src->size || soff + n < soff)
+    return -1;
+  if(soff + n > src->size)
+    n = src->size - soff;
+  if(doff > dst->size || doff + n < doff || doff + n > MAXFILE*BSIZE)
+    return -1;
+
+  itextinval(dst);
+
+  for(tot=0; tot<n; tot+=m, soff+=m, doff+=m){
+    m = min(n - tot, BSIZE - soff%BSIZE);
+    m = min(m, BSIZE - doff%BSIZE);
+    sbp = bread(src->dev, bmap(src, soff/BSIZE));
+    dbp = bread(dst->dev, bmap(dst, doff/BSIZE));
+    memmove(dbp->data + doff%BSIZE, sbp->data + soff%BSIZE, m);
+    log_write(dbp);
+    brelse(dbp);
+    brelse(sbp);
+  }
+
+  if(n > 0){
+    if(doff > dst->size)
+      dst->size = doff;
+    iupdate(dst);
+  }
+  return n;
+}
+
 // Directories
 
 int
@@ -633,8 +762,12 @@ namex(char *path, int nameiparent, char *name)
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    // another thread may chdir() meanwhile.
+    acquire(&myproc()->tg->lock);
+    ip = idup(myproc()->tg->cwd);
+    release(&myproc()->tg->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -3,7 +3,13 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+// Block size. The Makefile passes it to the kernel, the user
+// programs and mkfs (make BSIZE=4096); mkfs records it in the
+// super block, and the kernel won't mount a file system made
+// with a different one.
+#ifndef BSIZE
+#define BSIZE 1024
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -20,6 +26,7 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes); must be BSIZE
 };
 
 #define FSMAGIC 0x10203040
@@ -0,0 +1,97 @@
+// Futexes: a user-space lock or condition blocks with
+// futex_wait() only when it must, and futex_wake() wakes
+// its waiters; the uncontended paths never enter the kernel.
+//
+// A futex is a 32-bit word in user memory, named by its
+// physical address, which is also the channel its waiters
+// sleep() on. The waiters of each word sleep holding one
+// of NFUTEX locks, chosen by the address; futex_wait()
+// checks the word with that lock held, so a futex_wake()
+// after a change to the word can't be missed.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 16
+
+static struct spinlock futexlock[NFUTEX];
+
+#define FUTEXLOCK(pa) (&futexlock[((pa) / sizeof(int)) % NFUTEX])
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEX; i++)
+    initlock(&futexlock[i], "futex");
+}
+
+// The physical address of the current process's futex
+// word at user address uaddr, or 0 if there isn't one.
+// The page stays in use, so that another thread's sbrk()
+// can't free it, until uvmput(*tgp).
+static uint64
+futexaddr(uint64 uaddr, struct tgroup **tgp)
+{
+  uint64 pa;
+
+  if(uaddr % sizeof(int) != 0)
+    return 0;
+  if((pa = uvmget(myproc()->pagetable, uaddr, PTE_R, tgp)) == 0)
+    return 0;
+  return pa + (uaddr % PGSIZE);
+}
+
+// Sleep until futexwake() on uaddr, if the word there
+// still holds val. Returns 0 after sleeping, -1 if the
+// word didn't hold val, or the process was killed.
+int
+futexwait(uint64 uaddr, int val)
+{
+  struct spinlock *lk;
+  struct tgroup *tg;
+  uint64 pa;
+
+  if((pa = futexaddr(uaddr, &tg)) == 0)
+    return -1;
+  lk = FUTEXLOCK(pa);
+  acquire(lk);
+  if(*(volatile int*)pa != val || myproc()->killed){
+    release(lk);
+    uvmput(tg);
+    return -1;
+  }
+  // only the word's value needed the page; pa is just
+  // a channel from here on.
+  uvmput(tg);
+  sleep((void*)pa, lk);
+  release(lk);
+  return 0;
+}
+
+// Wake up to n threads waiting on the futex at uaddr.
+// Returns how many were woken.
+int
+futexwake(uint64 uaddr, int n)
+{
+  struct spinlock *lk;
+  struct tgroup *tg;
+  uint64 pa;
+  int woken;
+
+  if((pa = futexaddr(uaddr, &tg)) == 0)
+    return -1;
+  uvmput(tg);
+  lk = FUTEXLOCK(pa);
+  acquire(lk);
+  woken = wakeupn((void*)pa, n);
+  release(lk);
+  return woken;
+}
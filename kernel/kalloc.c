@@ -1,6 +1,15 @@
 // Physical memory allocator, for user processes,
-// kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// kernel stacks, and page-table pages.
+// Allocates whole 4096-byte pages, and 2-megabyte
+// megapages for large user allocations (see vm.c).
+//
+// Free memory is kept as aligned megapages where possible.
+// kalloc() splits a megapage into 4096-byte pages when it
+// runs out of those; pages are not merged back.
+//
+// kzalloc() hands out zeroed pages, from up to NZERO pages
+// that a kernel worker zeroes ahead of time (zerofill()), so
+// that page faults and sbrk() needn't wait for the zeroing.
 
 #include "types.h"
 #include "param.h"
@@ -8,6 +17,9 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "work.h"
+
+#define NZERO 32
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -18,16 +30,32 @@ struct run {
   struct run *next;
 };
 
+static void zerofill(void*);
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  struct run *superlist;  // free megapages
+  struct run *zerolist;   // zeroed pages, but for their run
+  int nzero;
+  struct work zerowork;   // runs zerofill()
 } kmem;
 
 void
 kinit()
 {
+  char *heap;
+
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  initwork(&kmem.zerowork, WQ_SYSTEM, zerofill, 0);
+
+  // the buddy allocator gets the first KHEAPSIZE-aligned
+  // KHEAPSIZE bytes after the kernel, so that its blocks are
+  // aligned to their size. the pages on either side are ours.
+  heap = (char*)(((uint64)end + KHEAPSIZE - 1) & ~(KHEAPSIZE - 1));
+  bd_init(heap, heap + KHEAPSIZE);
+  freerange(end, heap);
+  freerange(heap + KHEAPSIZE, (void*)PHYSTOP);
 }
 
 void
@@ -35,8 +63,15 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  while(p + PGSIZE <= (char*)pa_end){
+    if((uint64)p % SUPERPGSIZE == 0 && p + SUPERPGSIZE <= (char*)pa_end){
+      kfree_super(p);
+      p += SUPERPGSIZE;
+    } else {
+      kfree(p);
+      p += PGSIZE;
+    }
+  }
 }
 
 // Free the page of physical memory pointed at by v,
@@ -69,14 +104,115 @@ void *
 kalloc(void)
 {
   struct run *r;
+  char *p;
 
   acquire(&kmem.lock);
+  if(kmem.freelist == 0 && (r = kmem.superlist) != 0){
+    // split a megapage.
+    kmem.superlist = r->next;
+    for(p = (char*)r + SUPERPGSIZE - PGSIZE; p >= (char*)r; p -= PGSIZE){
+      ((struct run*)p)->next = kmem.freelist;
+      kmem.freelist = (struct run*)p;
+    }
+  }
   r = kmem.freelist;
   if(r)
     kmem.freelist = r->next;
+  else if((r = kmem.zerolist) != 0){
+    // out of memory but for the zeroed pages.
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  }
   release(&kmem.lock);
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Allocate one zeroed 4096-byte page.
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  struct run *r;
+  int low;
+
+  acquire(&kmem.lock);
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  }
+  low = kmem.nzero < NZERO/2;
+  release(&kmem.lock);
+
+  if(low)
+    queue_work(&kmem.zerowork);
+  if(r){
+    r->next = 0;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero pages for kzalloc(), until there are NZERO.
+static void
+zerofill(void *arg)
+{
+  struct run *r;
+
+  for(;;){
+    acquire(&kmem.lock);
+    if(kmem.nzero >= NZERO || (r = kmem.freelist) == 0){
+      release(&kmem.lock);
+      return;
+    }
+    kmem.freelist = r->next;
+    release(&kmem.lock);
+
+    memset((char*)r, 0, PGSIZE);
+
+    acquire(&kmem.lock);
+    r->next = kmem.zerolist;
+    kmem.zerolist = r;
+    kmem.nzero++;
+    release(&kmem.lock);
+  }
+}
+
+// Free a megapage returned by kalloc_super().
+// Unlike kfree(), doesn't fill it with junk;
+// that would cost more than the allocation.
+void
+kfree_super(void *pa)
+{
+  struct run *r;
+
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end || (uint64)pa + SUPERPGSIZE > PHYSTOP)
+    panic("kfree_super");
+
+  r = (struct run*)pa;
+
+  acquire(&kmem.lock);
+  r->next = kmem.superlist;
+  kmem.superlist = r;
+  release(&kmem.lock);
+}
+
+// Allocate one aligned 2-megabyte megapage.
+// Returns 0 if there is none free.
+void *
+kalloc_super(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.superlist;
+  if(r)
+    kmem.superlist = r->next;
+  release(&kmem.lock);
+  return (void*)r;
+}
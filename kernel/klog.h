@@ -0,0 +1,19 @@
+// Kernel log records, as klog() stores them
+// and dmesg() returns them.
+
+// severity levels, most severe first.
+#define KLOG_ERR    3
+#define KLOG_WARN   4
+#define KLOG_INFO   6
+#define KLOG_DEBUG  7
+
+#define KLOGMSG 116  // message bytes in a record, including the 0
+#define NKLOG    64  // records the kernel keeps per CPU
+
+struct klogrec {
+  uint64 usec;       // microseconds since boot
+  uchar level;       // KLOG_*
+  uchar cpu;         // CPU that logged it
+  ushort len;        // strlen(msg)
+  char msg[KLOGMSG];
+};
@@ -6,6 +6,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "work.h"
+#include "klog.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -21,6 +23,13 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// A transaction stays open after its last end_op(), and
+// collects the next system calls' updates too, until the
+// log fills, log_sync() (fsync(), sync()) asks for a
+// commit, or the flusher (a work item that logtick()
+// queues) finds it has been open COMMITAGE ticks. Until
+// then, repeated writes to a block cost nothing.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -28,7 +37,13 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A commit appends the transaction's blocks to the log, and
+// rewrites the header to cover them too. Log appends are
+// synchronous, but committed blocks are only marked dirty in
+// the buffer cache; bflush() writes them home later. Once the
+// log is nearly full, a commit writes all of them home and
+// empties the log. Recovery copies the logged blocks home in
+// order, so a block's latest copy wins.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,13 +58,19 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int syncing;     // log_sync() is waiting to commit; begin_op() waits.
+  int committed;   // lh.block[0..committed-1] are committed
+  uint opened;     // ticks when the open transaction began
   int dev;
   struct logheader lh;
 };
 struct log log[NDISK];
 
+#define COMMITAGE 10  // ticks before the flusher commits a transaction
+#define FLUSHAGE  30  // ticks before the flusher writes a dirty block home
+
 static void recover_from_log(int);
-static void commit(int);
+static void commit(int, int);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -64,7 +85,8 @@ initlog(int dev, struct superblock *sb)
   recover_from_log(dev);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// when recovering.
 static void
 install_trans(int dev)
 {
@@ -75,7 +97,6 @@ install_trans(int dev)
     struct buf *dbuf = bread(dev, log[dev].lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -127,7 +148,7 @@ begin_op(int dev)
 {
   acquire(&log[dev].lock);
   while(1){
-    if(log[dev].committing){
+    if(log[dev].committing || log[dev].syncing){
       sleep(&log, &log[dev].lock);
     } else if(log[dev].lh.n + (log[dev].outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
@@ -141,7 +162,8 @@ begin_op(int dev)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// and the log has no room for another.
 void
 end_op(int dev)
 {
@@ -151,7 +173,7 @@ end_op(int dev)
   log[dev].outstanding -= 1;
   if(log[dev].committing)
     panic("log[dev].committing");
-  if(log[dev].outstanding == 0){
+  if(log[dev].outstanding == 0 && log[dev].lh.n + MAXOPBLOCKS > LOGSIZE){
     do_commit = 1;
     log[dev].committing = 1;
   } else {
@@ -165,7 +187,7 @@ end_op(int dev)
   if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
-    commit(dev);
+    commit(dev, 0);
     acquire(&log[dev].lock);
     log[dev].committing = 0;
     wakeup(&log);
@@ -173,13 +195,13 @@ end_op(int dev)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the open transaction's blocks from cache to log.
 static void
 write_log(int dev)
 {
   int tail;
 
-  for (tail = 0; tail < log[dev].lh.n; tail++) {
+  for (tail = log[dev].committed; tail < log[dev].lh.n; tail++) {
     struct buf *to = bread(dev, log[dev].start+tail+1); // log block
     struct buf *from = bread(dev, log[dev].lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
@@ -189,16 +211,105 @@ write_log(int dev)
   }
 }
 
+// The open transaction's blocks are committed: let bflush()
+// write them home.
+static void
+mark_dirty(int dev)
+{
+  int tail;
+
+  for (tail = log[dev].committed; tail < log[dev].lh.n; tail++) {
+    struct buf *b = bread(dev, log[dev].lh.block[tail]);
+    bdirty(b);  // takes over log_write()'s pin
+    brelse(b);
+  }
+}
+
+// Commit the open transaction. If checkpoint is set, or
+// the log is nearly full, then write every logged block
+// home and empty the log. Caller has set committing.
 static void
-commit(int dev)
+commit(int dev, int checkpoint)
 {
-  if (log[dev].lh.n > 0) {
+  if (log[dev].lh.n > log[dev].committed) {
     write_log(dev);     // Write modified blocks from cache to log
     write_head(dev);    // Write header to disk -- the real commit
-    install_trans(dev); // Now install writes to home locations
-    log[dev].lh.n = 0;
-    write_head(dev);    // Erase the transaction from the log
+    mark_dirty(dev);    // Home locations can be written lazily
+    klog(KLOG_DEBUG, "log %d: committed %d blocks", dev,
+         log[dev].lh.n - log[dev].committed);
+    log[dev].committed = log[dev].lh.n;
+  }
+  if (log[dev].lh.n > 0 && (checkpoint || log[dev].lh.n + MAXOPBLOCKS > LOGSIZE)) {
+    bflush(dev, 0);     // Now install writes to home locations
+    log[dev].lh.n = log[dev].committed = 0;
+    write_head(dev);    // Erase the transactions from the log
+    klog(KLOG_DEBUG, "log %d: checkpoint", dev);
+  }
+}
+
+// Commit dev's open transaction, if any, and wait for the
+// commit; if checkpoint is set, also write the logged blocks
+// home. dev < 0 means every device with a log. For fsync(),
+// sync() and the flusher.
+void
+log_sync(int dev, int checkpoint)
+{
+  if(dev < 0){
+    for(dev = 0; dev < NDISK; dev++)
+      if(log[dev].size != 0)
+        log_sync(dev, checkpoint);
+    return;
+  }
+
+  acquire(&log[dev].lock);
+  while(log[dev].committing || log[dev].outstanding > 0){
+    log[dev].syncing = 1;   // keep begin_op() from starting more
+    sleep(&log, &log[dev].lock);
   }
+  log[dev].syncing = 0;
+  log[dev].committing = 1;
+  release(&log[dev].lock);
+
+  commit(dev, checkpoint);
+
+  acquire(&log[dev].lock);
+  log[dev].committing = 0;
+  wakeup(&log);
+  release(&log[dev].lock);
+}
+
+// The flusher: commits transactions that have been open
+// for COMMITAGE ticks, and writes home blocks that have
+// been dirty for FLUSHAGE. Runs in a WQ_SYSTEM worker, so
+// waits only for the disk and the log.
+static void
+flusher(void *arg)
+{
+  int dev, old;
+
+  for(dev = 0; dev < NDISK; dev++){
+    if(log[dev].size == 0)
+      continue;
+    acquire(&log[dev].lock);
+    old = log[dev].lh.n > log[dev].committed &&
+          ticks - log[dev].opened >= COMMITAGE;
+    release(&log[dev].lock);
+    if(old)
+      log_sync(dev, 0);
+  }
+  bflush(-1, FLUSHAGE);
+}
+
+static struct work flushwork = { flusher };
+
+// Called by clockintr() on each tick, with tickslock held.
+// clockintr() runs on CPU 0, so hand the flusher to each
+// CPU's worker in turn rather than always to CPU 0's.
+void
+logtick(void)
+{
+  if(ticks % COMMITAGE == 0)
+    queue_work_on(workcpu(ticks / COMMITAGE), &flushwork);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -222,13 +333,15 @@ log_write(struct buf *b)
     panic("log_write outside of trans");
 
   acquire(&log[dev].lock);
-  for (i = 0; i < log[dev].lh.n; i++) {
+  for (i = log[dev].committed; i < log[dev].lh.n; i++) {
     if (log[dev].lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
   log[dev].lh.block[i] = b->blockno;
   if (i == log[dev].lh.n) {  // Add new block to log?
     bpin(b);
+    if (log[dev].lh.n == log[dev].committed)
+      log[dev].opened = ticks;
     log[dev].lh.n++;
   }
   release(&log[dev].lock);
@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "file.h"
 #include "defs.h"
+#include "klog.h"
 
 volatile static int started = 0;
 
@@ -31,18 +32,28 @@ main()
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
-    virtio_disk_init(minor(ROOTDEV)); // emulated hard disk
+    pipeinit();      // pipe cache
+    textinit();      // shared program text
+    futexinit();     // user-space lock waits
+    pollinit();      // poll() wait queues
+    workinit();      // deferred work queues
+    virtio_disk_init(0); // emulated hard disk
+#ifdef RAMROOT
+    ramdiskinit(RAMDISKDEV); // fs.img, loaded into RAM by qemu
+#endif
     userinit();      // first user process
+    workstart();     // this CPU's worker thread
     __sync_synchronize();
     started = 1;
   } else {
     while(started == 0)
       ;
     __sync_synchronize();
-    printf("hart %d starting\n", cpuid());
+    klog(KLOG_INFO, "hart %d starting", cpuid());
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
     plicinithart();   // ask PLIC for device interrupts
+    workstart();      // this CPU's worker thread
   }
 
   scheduler();        
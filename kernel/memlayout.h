@@ -16,6 +16,9 @@
 // 80000000 -- entry.S, then kernel text and data
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
+// RAMDISK -- fs.img, if qemu loaded it (make RAMROOT=1)
+// kinit() sets aside the first KHEAPSIZE-aligned KHEAPSIZE
+// bytes after end as the heap for buddy.c and slab.c.
 
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
@@ -28,8 +31,10 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define TIMEBASE 10000000L  // CLINT_MTIME (and the time CSR) ticks per second
 
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
@@ -48,6 +53,15 @@
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128*1024*1024)
 
+// with make RAMROOT=1, qemu has RAMDISKSIZE more bytes of
+// RAM, and loads fs.img there, at RAMDISK (see ramdisk.c).
+// The Makefile reads both from here for qemu's options.
+#define RAMDISK PHYSTOP
+#define RAMDISKSIZE (16*1024*1024)
+
+// size of the kernel object heap; a power of two.
+#define KHEAPSIZE (1024*1024L)
+
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
@@ -63,6 +77,10 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   USERTOP, URING: uring_setup()'s rings (see uring.c)
+//   threads' trapframes (see TFSLOT() in proc.h)
 //   TRAPFRAME (p->tf, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define URING (TRAPFRAME - NTHREAD*PGSIZE)
+#define USERTOP URING
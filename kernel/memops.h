@@ -0,0 +1,120 @@
+// Word-at-a-time memset, memmove and memcmp, shared by
+// kernel/string.c and user/ulib.c, which wrap them with
+// their own prototypes. Include after types.h.
+//
+// Bytes are handled one at a time up to an 8-byte boundary,
+// then 64 bytes per loop iteration in 64-bit words, then
+// single words, then the tail bytes. Word accesses are used
+// only when both pointers share an alignment, since RISC-V
+// may trap on misaligned loads and stores.
+
+static inline void
+memops_set(uchar *d, int c, uint64 n)
+{
+  uint64 w, *wd;
+
+  for(; n > 0 && ((uint64)d & 7); n--)
+    *d++ = c;
+
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wd = (uint64*)d;
+  for(; n >= 64; n -= 64, wd += 8){
+    wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+    wd[4] = w; wd[5] = w; wd[6] = w; wd[7] = w;
+  }
+  for(; n >= 8; n -= 8)
+    *wd++ = w;
+
+  d = (uchar*)wd;
+  while(n-- > 0)
+    *d++ = c;
+}
+
+static inline void
+memops_move(uchar *d, const uchar *s, uint64 n)
+{
+  uint64 *wd, a0, a1, a2, a3, a4, a5, a6, a7;
+  const uint64 *ws;
+  int aligned;
+
+  if(d == s || n == 0)
+    return;
+  aligned = (((uint64)d ^ (uint64)s) & 7) == 0;
+
+  if(s > d || s + n <= d){
+    // copy forwards. each group of words is loaded
+    // before any is stored, so d just below s is fine.
+    if(aligned){
+      for(; n > 0 && ((uint64)d & 7); n--)
+        *d++ = *s++;
+      wd = (uint64*)d;
+      ws = (const uint64*)s;
+      for(; n >= 64; n -= 64, wd += 8, ws += 8){
+        a0 = ws[0]; a1 = ws[1]; a2 = ws[2]; a3 = ws[3];
+        a4 = ws[4]; a5 = ws[5]; a6 = ws[6]; a7 = ws[7];
+        wd[0] = a0; wd[1] = a1; wd[2] = a2; wd[3] = a3;
+        wd[4] = a4; wd[5] = a5; wd[6] = a6; wd[7] = a7;
+      }
+      for(; n >= 8; n -= 8)
+        *wd++ = *ws++;
+      d = (uchar*)wd;
+      s = (const uchar*)ws;
+    }
+    while(n-- > 0)
+      *d++ = *s++;
+  } else {
+    // s < d < s+n: copy backwards.
+    d += n;
+    s += n;
+    if(aligned){
+      for(; n > 0 && ((uint64)d & 7); n--)
+        *--d = *--s;
+      wd = (uint64*)d;
+      ws = (const uint64*)s;
+      for(; n >= 64; n -= 64){
+        wd -= 8;
+        ws -= 8;
+        a0 = ws[0]; a1 = ws[1]; a2 = ws[2]; a3 = ws[3];
+        a4 = ws[4]; a5 = ws[5]; a6 = ws[6]; a7 = ws[7];
+        wd[0] = a0; wd[1] = a1; wd[2] = a2; wd[3] = a3;
+        wd[4] = a4; wd[5] = a5; wd[6] = a6; wd[7] = a7;
+      }
+      for(; n >= 8; n -= 8)
+        *--wd = *--ws;
+      d = (uchar*)wd;
+      s = (const uchar*)ws;
+    }
+    while(n-- > 0)
+      *--d = *--s;
+  }
+}
+
+static inline int
+memops_cmp(const uchar *s1, const uchar *s2, uint64 n)
+{
+  const uint64 *w1, *w2;
+
+  if((((uint64)s1 ^ (uint64)s2) & 7) == 0){
+    for(; n > 0 && ((uint64)s1 & 7); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    w1 = (const uint64*)s1;
+    w2 = (const uint64*)s2;
+    // skip equal words 32 bytes at a time, then one at a
+    // time; the differing byte, if any, is then found below.
+    for(; n >= 32; n -= 32, w1 += 4, w2 += 4)
+      if((w1[0] ^ w2[0]) | (w1[1] ^ w2[1]) | (w1[2] ^ w2[2]) | (w1[3] ^ w2[3]))
+        break;
+    for(; n >= 8 && *w1 == *w2; n -= 8)
+      w1++, w2++;
+    s1 = (const uchar*)w1;
+    s2 = (const uchar*)w2;
+  }
+  for(; n > 0; n--, s1++, s2++)
+    if(*s1 != *s2)
+      return *s1 - *s2;
+  return 0;
+}
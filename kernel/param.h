@@ -1,14 +1,23 @@
-#define NPROC        10  // maximum number of processes
+#define NPROC        (10+2*NCPU)  // maximum number of processes, and two workers per CPU (work.c)
 #define NCPU          8  // maximum number of CPUs
+#define NTHREAD       8  // maximum threads per process
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NFILE       100  // open files alloctest expects to fit
+#define NINODE       50  // i-nodes usertests' iref cycles through
+#define NIUNUSED     50  // unreferenced i-nodes iput() keeps cached
 #define NDEV         10  // maximum major device number
+#define RAMDISKDEV    2  // device number of the RAM disk (ramdisk.c)
+#ifdef RAMROOT
+#define ROOTDEV      RAMDISKDEV  // device number of file system root disk
+#else
 #define ROOTDEV       0  // device number of file system root disk
+#endif
 #define MAXARG       32  // max exec arguments
+#define NSEG          4  // max loadable ELF segments, for exec
+#define NTEXT       256  // max pages of programs' text to cache
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*6)  // max size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define NDISK        2
+#define NDISK        3  // virtio disks 0 and 1, and the RAM disk
@@ -3,22 +3,60 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+// a pipe's ring holds PGSIZE bytes, in a page from kalloc(),
+// unless fcntl(F_SETPIPE_SZ) changes it to another power of
+// two up to PIPEMAX, which comes from bd_malloc().
+#define PIPEMAX (64*1024)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // ring buffer
+  uint size;      // bytes in data, a power of two
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // a splice or tee is copying out of data
+  int wbusy;      // a splice is copying into data
+  struct pollq pollq;  // poll() calls watching either side
 };
 
+static void
+ringfree(char *data, uint size)
+{
+  if(size == PGSIZE)
+    kfree(data);
+  else
+    bd_free(data);
+}
+
+static struct kmem_cache *pipecache;
+
+static void
+pipector(void *p)
+{
+  initlock(&((struct pipe*)p)->lock, "pipe");
+}
+
+static void
+pipedtor(void *p)
+{
+  freelock(&((struct pipe*)p)->lock);
+}
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe), pipector, pipedtor);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +66,21 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
+  if((pi->data = kalloc()) == 0){
+    kmem_cache_free(pipecache, pi);
+    pi = 0;
+    goto bad;
+  }
+  pi->size = PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  memset(&pi->lock, 0, sizeof(pi->lock));
+  pi->rbusy = 0;
+  pi->wbusy = 0;
+  pi->pollq.first = 0;
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -46,8 +92,6 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,62 +110,287 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwakeup(&pi->pollq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    ringfree(pi->data, pi->size);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Copy as much of user memory [addr, addr+n) into the ring
+// as fits, in at most two contiguous segments. Returns the
+// number of bytes copied, or -1 if copyin() failed at once.
+static int
+ringin(struct pipe *pi, pagetable_t pagetable, uint64 addr, int n)
+{
+  uint off, m;
+  int tot;
+
+  for(tot = 0; tot < n && pi->nwrite != pi->nread + pi->size; tot += m){
+    off = pi->nwrite & (pi->size - 1);
+    m = pi->size - off;                           // up to the end of data
+    if(m > pi->size - (pi->nwrite - pi->nread))   // free space
+      m = pi->size - (pi->nwrite - pi->nread);
+    if(m > n - tot)
+      m = n - tot;
+    if(copyin(pagetable, pi->data + off, addr + tot, m) == -1)
+      return tot > 0 ? tot : -1;
+    pi->nwrite += m;
+  }
+  return tot;
+}
+
+// Copy up to n bytes from the ring to user memory at addr,
+// in at most two contiguous segments. Returns the number of
+// bytes copied, or -1 if copyout() failed at once.
+static int
+ringout(struct pipe *pi, pagetable_t pagetable, uint64 addr, int n)
+{
+  uint off, m;
+  int tot;
+
+  for(tot = 0; tot < n && pi->nread != pi->nwrite; tot += m){
+    off = pi->nread & (pi->size - 1);
+    m = pi->size - off;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > n - tot)
+      m = n - tot;
+    if(copyout(pagetable, addr + tot, pi->data + off, m) == -1)
+      return tot > 0 ? tot : -1;
+    pi->nread += m;
+  }
+  return tot;
+}
+
+// If nonblock, write only what fits without waiting.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
-  int i;
-  char ch;
+  int i, m = 0;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(pi->wbusy || pi->nwrite == pi->nread + pi->size){  //DOC: pipewrite-full
       if(pi->readopen == 0 || myproc()->killed){
         release(&pi->lock);
         return -1;
       }
+      if(nonblock)
+        goto done;
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    if((m = ringin(pi, pr->pagetable, addr + i, n - i)) < 0)
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
   }
+done:
   wakeup(&pi->nread);
+  pollwakeup(&pi->pollq);
   release(&pi->lock);
-  return n;
+  if(i == 0 && n > 0)
+    return m < 0 ? -1 : EAGAIN;
+  return i;
 }
 
+// If nonblock, return EAGAIN rather than wait for data.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
   int i;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
     if(myproc()->killed){
       release(&pi->lock);
       return -1;
     }
+    if(nonblock){
+      release(&pi->lock);
+      return EAGAIN;
+    }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
-  }
+  i = ringout(pi, pr->pagetable, addr, n);  //DOC: piperead-copy
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pollwakeup(&pi->pollq);
   release(&pi->lock);
   return i;
 }
+
+// The poll() events ready on pi's write side if writable,
+// else on its read side. Puts e, if not 0, on pi's pollq.
+int
+pipepoll(struct pipe *pi, int writable, struct pollent *e)
+{
+  int r = 0;
+
+  if(e)
+    pollqueue(&pi->pollq, e);
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      r = POLLERR;
+    else if(pi->nwrite != pi->nread + pi->size)
+      r = POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r = POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLHUP;
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// The size of pi's ring, for fcntl(F_GETPIPE_SZ).
+int
+pipegetsize(struct pipe *pi)
+{
+  return pi->size;
+}
+
+// Resize pi's ring to n bytes, rounded up to a power of two
+// of at least PGSIZE, for fcntl(F_SETPIPE_SZ). Fails if n is
+// over PIPEMAX or the ring holds more than n bytes.
+// Returns the new size, or -1.
+int
+pipesetsize(struct pipe *pi, int n)
+{
+  char *data, *old;
+  uint size, oldsize, len, off, m;
+
+  if(n < 0 || n > PIPEMAX)
+    return -1;
+  for(size = PGSIZE; size < n; size *= 2)
+    ;
+  data = size == PGSIZE ? kalloc() : bd_malloc(size);
+  if(data == 0)
+    return -1;
+
+  acquire(&pi->lock);
+  while(pi->rbusy || pi->wbusy)
+    sleep(&pi->nwrite, &pi->lock);
+  len = pi->nwrite - pi->nread;
+  if(len > size){
+    release(&pi->lock);
+    ringfree(data, size);
+    return -1;
+  }
+  // unwrap the contents into the start of the new ring.
+  off = pi->nread & (pi->size - 1);
+  m = pi->size - off < len ? pi->size - off : len;
+  memmove(data, pi->data + off, m);
+  memmove(data + m, pi->data, len - m);
+  old = pi->data;
+  oldsize = pi->size;
+  pi->data = data;
+  pi->size = size;
+  pi->nread = 0;
+  pi->nwrite = len;
+  wakeup(&pi->nwrite);
+  pollwakeup(&pi->pollq);
+  release(&pi->lock);
+
+  ringfree(old, oldsize);
+  return size;
+}
+
+// splice() and tee() (file.c) copy into and out of the ring
+// without holding pi->lock, since readi() and writei() may sleep.
+// Meanwhile, the splice owns the ring's free space (wbusy) or its
+// contents (rbusy), and other readers and writers wait.
+
+// Wait for free space in pi's ring and claim it. Returns the
+// first contiguous free segment, and sets *n to its length,
+// at most *n. Returns 0 if the read side is closed or the
+// caller has been killed. Follow with pipewend().
+char*
+pipewbegin(struct pipe *pi, int *n)
+{
+  uint off, m;
+
+  acquire(&pi->lock);
+  while(pi->wbusy || pi->nwrite == pi->nread + pi->size){
+    if(pi->readopen == 0 || myproc()->killed){
+      release(&pi->lock);
+      return 0;
+    }
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  pi->wbusy = 1;
+  off = pi->nwrite & (pi->size - 1);
+  m = pi->size - off;
+  if(m > pi->size - (pi->nwrite - pi->nread))
+    m = pi->size - (pi->nwrite - pi->nread);
+  if(m > *n)
+    m = *n;
+  *n = m;
+  release(&pi->lock);
+  return pi->data + off;
+}
+
+// m bytes have been copied to the segment pipewbegin() returned.
+void
+pipewend(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nwrite += m;
+  pi->wbusy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  pollwakeup(&pi->pollq);
+  release(&pi->lock);
+}
+
+// Claim the data in pi's ring, skipping its first skip bytes,
+// waiting for some if wait is set and the write side is open.
+// Returns the first contiguous segment of it, and sets *n to its
+// length, at most *n; 0 if there is none. Returns 0 if the
+// caller has been killed. Follow with piperend().
+char*
+piperbegin(struct pipe *pi, int skip, int *n, int wait)
+{
+  uint off, m;
+
+  acquire(&pi->lock);
+  while(pi->rbusy || (wait && pi->nwrite - pi->nread <= skip && pi->writeopen)){
+    if(myproc()->killed){
+      release(&pi->lock);
+      return 0;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  pi->rbusy = 1;
+  m = 0;
+  off = (pi->nread + skip) & (pi->size - 1);
+  if(pi->nwrite - pi->nread > skip){
+    m = pi->size - off;
+    if(m > pi->nwrite - pi->nread - skip)
+      m = pi->nwrite - pi->nread - skip;
+  }
+  if(m > *n)
+    m = *n;
+  *n = m;
+  release(&pi->lock);
+  return pi->data + off;
+}
+
+// Done with the data piperbegin() returned;
+// consume the first m bytes of the ring.
+void
+piperend(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nread += m;
+  pi->rbusy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  pollwakeup(&pi->pollq);
+  release(&pi->lock);
+}
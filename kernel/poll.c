@@ -0,0 +1,175 @@
+// poll(): wait for any of several files to become
+// readable or writable.
+//
+// Pipes and the console each have a struct pollq, a wait
+// queue of the poll() calls watching them. poll() puts a
+// struct pollent on each file's queue, checks the files,
+// and sleeps if none is ready; pollwakeup() from the pipe
+// or console marks every call on the queue ready and wakes
+// it up, and poll() checks the files again.
+//
+// The queues and the ready flags are protected by polllock.
+// poll() joins a queue before checking the file, and clears
+// its ready flag before that, so it can't miss an event.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+#include "proc.h"
+#include "defs.h"
+
+// a poll() call in progress; what its pollents point to.
+struct pollwait {
+  int ready;               // a file may be ready, or the timeout passed
+  uint deadline;           // ticks, if on polltimers
+  struct pollwait *tnext;  // on polltimers
+};
+
+static struct spinlock polllock;
+static struct pollwait *polltimers;  // calls with a timeout
+
+void
+pollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+// Put e, for the poll() call w, on wait queue q.
+void
+pollqueue(struct pollq *q, struct pollent *e)
+{
+  acquire(&polllock);
+  e->q = q;
+  e->next = q->first;
+  q->first = e;
+  release(&polllock);
+}
+
+// Take e off its wait queue.
+static void
+pollunqueue(struct pollent *e)
+{
+  struct pollent **pp;
+
+  acquire(&polllock);
+  for(pp = &e->q->first; *pp != e; pp = &(*pp)->next)
+    ;
+  *pp = e->next;
+  release(&polllock);
+}
+
+// Something happened to the file q belongs to: wake up
+// the poll() calls on q. Callers may hold the file's lock.
+void
+pollwakeup(struct pollq *q)
+{
+  struct pollent *e;
+
+  // poll() joins q before it checks the file, so
+  // if it isn't on q, it will see what happened.
+  if(q->first == 0)
+    return;
+  acquire(&polllock);
+  for(e = q->first; e; e = e->next){
+    e->w->ready = 1;
+    wakeup(e->w);
+  }
+  release(&polllock);
+}
+
+// Wake up the poll() calls whose timeout has passed.
+// Called by clockintr(), with tickslock held.
+void
+polltick(void)
+{
+  struct pollwait *w;
+
+  if(polltimers == 0)
+    return;
+  acquire(&polllock);
+  for(w = polltimers; w; w = w->tnext){
+    if((int)(ticks - w->deadline) >= 0){
+      w->ready = 1;
+      wakeup(w);
+    }
+  }
+  release(&polllock);
+}
+
+// Wait until one of the n files f[] is ready for the events in
+// fds[].events, or timeout ticks pass (forever if timeout < 0),
+// and set fds[].revents. f[i] is 0 if fds[i].fd isn't open.
+// Returns how many files are ready, or -1 if killed.
+int
+poll(struct file **f, struct pollfd *fds, int n, int timeout)
+{
+  struct pollent e[NOFILE];
+  struct pollwait w, **pp;
+  int i, nready, r, first, expired;
+
+  w.ready = 0;
+  expired = 0;
+  if(timeout > 0){
+    acquire(&tickslock);
+    w.deadline = ticks + timeout;
+    acquire(&polllock);
+    w.tnext = polltimers;
+    polltimers = &w;
+    release(&polllock);
+    release(&tickslock);
+  }
+
+  for(first = 1; ; first = 0){
+    acquire(&polllock);
+    w.ready = 0;
+    release(&polllock);
+
+    nready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(f[i] == 0){
+        fds[i].revents = POLLNVAL;
+        nready++;
+        continue;
+      }
+      if(first){
+        e[i].w = &w;
+        e[i].q = 0;
+      }
+      r = filepoll(f[i], first ? &e[i] : 0);
+      r &= fds[i].events | POLLERR | POLLHUP;
+      if(r){
+        fds[i].revents = r;
+        nready++;
+      }
+    }
+    if(nready > 0 || timeout == 0 || expired || myproc()->killed)
+      break;
+
+    acquire(&polllock);
+    if(!w.ready)
+      sleep(&w, &polllock);
+    expired = timeout > 0 && (int)(ticks - w.deadline) >= 0;
+    release(&polllock);
+  }
+
+  for(i = 0; i < n; i++)
+    if(f[i] && e[i].q)
+      pollunqueue(&e[i]);
+  if(timeout > 0){
+    acquire(&polllock);
+    for(pp = &polltimers; *pp != &w; pp = &(*pp)->tnext)
+      ;
+    *pp = w.tnext;
+    release(&polllock);
+  }
+
+  if(nready == 0 && myproc()->killed)
+    return -1;
+  return nready;
+}
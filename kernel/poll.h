@@ -0,0 +1,12 @@
+// poll() events
+#define POLLIN    0x001  // data to read, without blocking
+#define POLLOUT   0x004  // room to write, without blocking
+#define POLLERR   0x008  // a pipe's read side is closed
+#define POLLHUP   0x010  // a pipe's write side is closed
+#define POLLNVAL  0x020  // fd isn't open
+
+struct pollfd {
+  int fd;
+  short events;   // events to wait for
+  short revents;  // events that happened
+};
@@ -1,5 +1,6 @@
 //
-// formatted console output -- printf, panic.
+// formatted console output -- printf, panic --
+// and the kernel log -- klog, dmesg.
 //
 
 #include <stdarg.h>
@@ -14,6 +15,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "klog.h"
 
 volatile int panicked = 0;
 
@@ -25,8 +27,23 @@ static struct {
 
 static char digits[] = "0123456789abcdef";
 
+// vprintf() and its helpers send characters to the
+// console if r is 0, or else append them to log record r.
+// without pr.locking (early in boot, or in panic()),
+// console output is polled and takes no locks.
 static void
-printint(int xx, int base, int sign)
+outc(struct klogrec *r, int c)
+{
+  if(r == 0 && !pr.locking)
+    uartputc_sync(c);
+  else if(r == 0)
+    consputc(c);
+  else if(r->len < KLOGMSG-1)
+    r->msg[r->len++] = c;
+}
+
+static void
+printint(struct klogrec *r, int xx, int base, int sign)
 {
   char buf[16];
   int i;
@@ -46,38 +63,28 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    outc(r, buf[i]);
 }
 
 static void
-printptr(uint64 x)
+printptr(struct klogrec *r, uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  outc(r, '0');
+  outc(r, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    outc(r, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
-void
-printf(char *fmt, ...)
+static void
+vprintf(struct klogrec *r, char *fmt, va_list ap)
 {
-  va_list ap;
-  int i, c, locking;
+  int i, c;
   char *s;
 
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-
-  if (fmt == 0)
-    panic("null fmt");
-
-  va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      outc(r, c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -85,30 +92,49 @@ printf(char *fmt, ...)
       break;
     switch(c){
     case 'd':
-      printint(va_arg(ap, int), 10, 1);
+      printint(r, va_arg(ap, int), 10, 1);
       break;
     case 'x':
-      printint(va_arg(ap, int), 16, 1);
+      printint(r, va_arg(ap, int), 16, 1);
       break;
     case 'p':
-      printptr(va_arg(ap, uint64));
+      printptr(r, va_arg(ap, uint64));
       break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        outc(r, *s);
       break;
     case '%':
-      consputc('%');
+      outc(r, '%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      outc(r, '%');
+      outc(r, c);
       break;
     }
   }
+}
+
+// Print to the console. only understands %d, %x, %p, %s.
+void
+printf(char *fmt, ...)
+{
+  va_list ap;
+  int locking;
+
+  locking = pr.locking;
+  if(locking)
+    acquire(&pr.lock);
+
+  if (fmt == 0)
+    panic("null fmt");
+
+  va_start(ap, fmt);
+  vprintf(0, fmt, ap);
+  va_end(ap);
 
   if(locking)
     release(&pr.lock);
@@ -122,6 +148,7 @@ panic(char *s)
   printf(s);
   printf("\n");
   printf("HINT: restart xv6 using 'make qemu-gdb', type 'b panic' (to set breakpoint in panic) in the gdb window, followed by 'c' (continue), and when the kernel hits the breakpoint, type 'bt' to get a backtrace\n");
+  uartflush();
   panicked = 1; // freeze other CPUs
   for(;;)
     ;
@@ -133,3 +160,121 @@ printfinit(void)
   initlock(&pr.lock, "pr");
   pr.locking = 1;
 }
+
+// The kernel log: a ring of the last NKLOG records for each
+// CPU. klog() appends to the current CPU's ring with
+// interrupts off and no lock, so that logging from hot paths
+// is cheap and never waits for the uart or for other CPUs.
+// Readers copy a record and then check that its CPU hasn't
+// overwritten it meanwhile. The CPU 0 clock interrupt copies
+// new records at or above KLOG_INFO to the console.
+static struct {
+  struct klogrec rec[NKLOG];
+  uint64 w;         // records written; the next goes in rec[w % NKLOG]
+} klogcpu[NCPU];
+
+static uint64 klogflushed[NCPU];  // next record of each CPU for the console
+static int klogconslevel = KLOG_INFO;
+
+// Log a message at severity level (KLOG_*).
+// Formats like printf(); no trailing newline needed.
+void
+klog(int level, char *fmt, ...)
+{
+  va_list ap;
+  struct klogrec *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  r = &klogcpu[id].rec[klogcpu[id].w % NKLOG];
+  r->usec = r_time() / (TIMEBASE / 1000000);
+  r->level = level;
+  r->cpu = id;
+  r->len = 0;
+  va_start(ap, fmt);
+  vprintf(r, fmt, ap);
+  va_end(ap);
+  r->msg[r->len] = 0;
+  __sync_synchronize();
+  klogcpu[id].w++;
+  pop_off();
+}
+
+// Copy the oldest record after the per-CPU cursors cur[]
+// into *out, and advance that CPU's cursor. Records that
+// were overwritten before the cursor reached them are
+// skipped. Returns 0 if there are no more.
+static int
+klognext(uint64 *cur, struct klogrec *out)
+{
+  struct klogrec r;
+  uint64 w;
+  int i, best;
+
+  best = -1;
+  for(i = 0; i < NCPU; i++){
+    for(;;){
+      w = klogcpu[i].w;
+      __sync_synchronize();
+      if(w - cur[i] > NKLOG)
+        cur[i] = w - NKLOG;
+      if(cur[i] == w)
+        break;
+      r = klogcpu[i].rec[cur[i] % NKLOG];
+      __sync_synchronize();
+      if(klogcpu[i].w < cur[i] + NKLOG)
+        break;   // not overwritten while copying
+    }
+    if(cur[i] == w)
+      continue;
+    if(best < 0 || r.usec < out->usec){
+      *out = r;
+      best = i;
+    }
+  }
+  if(best < 0)
+    return 0;
+  cur[best]++;
+  return 1;
+}
+
+// Copy records logged since the last call to the console,
+// as "[seconds.microseconds] message". The CPU 0 clock
+// interrupt calls this.
+void
+klogflush(void)
+{
+  struct klogrec r;
+  char frac[7];
+  uint64 us;
+  int i;
+
+  while(klognext(klogflushed, &r)){
+    if(r.level > klogconslevel)
+      continue;
+    us = r.usec % 1000000;
+    for(i = 5; i >= 0; i--, us /= 10)
+      frac[i] = '0' + us % 10;
+    frac[6] = 0;
+    printf("[%d.%s] %s\n", (int)(r.usec / 1000000), frac, r.msg);
+  }
+}
+
+// Copy up to n of the log's records, oldest first,
+// to user address dst, for dmesg(). Returns the
+// number copied, or -1.
+int
+klogread(uint64 dst, int n)
+{
+  uint64 cur[NCPU];
+  struct klogrec r;
+  int i;
+
+  memset(cur, 0, sizeof(cur));
+  for(i = 0; i < n && klognext(cur, &r); i++){
+    if(copyout(myproc()->pagetable, dst + i*sizeof(r), (char*)&r, sizeof(r)) < 0)
+      return -1;
+  }
+  return i;
+}
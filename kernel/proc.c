@@ -18,17 +18,35 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+static struct kmem_cache *tgcache;
+
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
+static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+static void
+tgctor(void *p)
+{
+  initlock(&((struct tgroup*)p)->lock, "tgroup");
+  initsleeplock(&((struct tgroup*)p)->vmlock, "vm");
+}
+
+static void
+tgdtor(void *p)
+{
+  freelock(&((struct tgroup*)p)->lock);
+  freelock(&((struct tgroup*)p)->vmlock.lk);
+}
+
 void
 procinit(void)
 {
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  tgcache = kmem_cache_create("tgroup", sizeof(struct tgroup), tgctor, tgdtor);
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
 
@@ -107,15 +125,17 @@ allocproc(void)
 
 found:
   p->pid = allocpid();
+  p->state = USED;
+  p->cpu = -1;
 
   // Allocate a trapframe page.
   if((p->tf = (struct trapframe *)kalloc()) == 0){
+    p->state = UNUSED;
     release(&p->lock);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
+  p->tfva = TRAPFRAME;
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -126,19 +146,83 @@ found:
   return p;
 }
 
+// Give p, the first thread of a new process, a thread
+// group with an empty user page table.
+// Returns 0, or -1 if out of memory.
+static int
+tgalloc(struct proc *p)
+{
+  struct tgroup *tg;
+
+  if((tg = kmem_cache_alloc(tgcache)) == 0)
+    return -1;
+  tg->ref = 1;
+  tg->nthread = 1;
+  tg->exiting = 0;
+  tg->execing = 0;
+  tg->xstate = 0;
+  tg->tfslots = 1;
+  memset(tg->ofile, 0, sizeof(tg->ofile));
+  tg->cwd = 0;
+  tg->sz = 0;
+  tg->execip = 0;
+  tg->nseg = 0;
+  tg->ncopy = 0;
+  tg->uring = 0;
+  tg->uringwork = 0;
+  tg->uringbusy = 0;
+  tg->uringmore = 0;
+  tg->uringstop = 0;
+  tg->uringproc = 0;
+  tg->leader = p;
+  tg->asidgen = 0;
+  p->tg = tg;
+  tg->pagetable = p->pagetable = proc_pagetable(p);
+  return 0;
+}
+
+// Drop p's reference to its thread group. The last one,
+// always the leader's, frees the user page table and memory;
+// the others just give up p's trapframe slot. Caller holds
+// p->lock, and tg->lock unless p is the leader.
+static void
+tgput(struct proc *p)
+{
+  struct tgroup *tg = p->tg;
+
+  if(--tg->ref > 0){
+    if(p == tg->leader)
+      panic("tgput");
+    // only p used this PTE, and the page-table page holding
+    // it also maps TRAMPOLINE, so this doesn't race with
+    // other threads changing the page table. the slot's
+    // next user flushes any stale TLB entry (see uvmsatp()).
+    uvmunmap(tg->pagetable, p->tfva, PGSIZE, 0);
+    uvmflush(p, p->tfva, PGSIZE);
+    tg->tfslots &= ~(1 << (TRAPFRAME - p->tfva) / PGSIZE);
+    return;
+  }
+  if(tg->pagetable)
+    proc_freepagetable(tg->pagetable, tg->sz);
+  if(tg->uringwork)
+    bd_free(tg->uringwork);
+  kmem_cache_free(tgcache, tg);
+}
+
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages if it is its process's last thread.
+// p->lock must be held, and p->tg->lock too if p is
+// a clone()d thread.
 static void
 freeproc(struct proc *p)
 {
+  if(p->tg)
+    tgput(p);
+  p->tg = 0;
+  p->pagetable = 0;
   if(p->tf)
     kfree((void*)p->tf);
   p->tf = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -179,6 +263,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, PGSIZE, 0);
   uvmunmap(pagetable, TRAPFRAME, PGSIZE, 0);
+  uvmunmap(pagetable, URING, PGSIZE, 1);
   if(sz > 0)
     uvmfree(pagetable, sz);
 }
@@ -202,42 +287,102 @@ userinit(void)
   struct proc *p;
 
   p = allocproc();
+  if(p == 0 || tgalloc(p) < 0)
+    panic("userinit");
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->tg->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->tf->epc = 0;      // user program counter
   p->tf->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  p->tg->cwd = namei("/");
 
   p->state = RUNNABLE;
 
   release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
+// A new kernel thread's first scheduling by scheduler()
+// will swtch to kthreadstart.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn(p->karg);
+  panic("kthread returned");
+}
+
+// Start a kernel thread running fn(arg). It has no user
+// memory (p->tg is 0), runs only in the kernel, and must
+// never return. Returns its pid, or -1.
 int
-growproc(int n)
+kthread_create(void (*fn)(void*), void *arg, char *name)
 {
-  uint sz;
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+  // it never goes to user space, so needs no trapframe.
+  kfree((void*)p->tf);
+  p->tf = 0;
+  p->tg = 0;
+  p->pagetable = 0;
+  p->kfn = fn;
+  p->karg = arg;
+  p->context.ra = (uint64)kthreadstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+  p->state = RUNNABLE;
+  release(&p->lock);
+  return pid;
+}
+
+// Grow or shrink user memory by n bytes, and set *oldsz
+// to the old size. Return 0 on success, -1 on failure.
+int
+growproc(int n, int *oldsz)
+{
+  uint64 sz;
   struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
 
-  sz = p->sz;
+  acquiresleep(&tg->vmlock);
+  sz = *oldsz = tg->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > USERTOP || (sz = uvmalloc(tg->pagetable, sz, sz + n)) == 0) {
+      releasesleep(&tg->vmlock);
       return -1;
     }
+    // the TLBs may hold misses for the new pages.
+    uvmflush(p, tg->sz, sz - tg->sz);
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(-n > sz)
+      n = -sz;
+    if(tg->nthread > 1 || tg->uringbusy){
+      // other threads, or the group's ring worker, may be
+      // using the pages on other CPUs; take the pages away
+      // from them, and wait for copies that found a page
+      // before that, before the pages are freed.
+      uvmrevoke(tg->pagetable, sz + n, -n);
+      uvmshootdown(p);
+      while(__atomic_load_n(&tg->ncopy, __ATOMIC_SEQ_CST) > 0)
+        yield();
+    }
+    sz = uvmdealloc(tg->pagetable, sz, sz + n);
+    uvmflush(p, sz, tg->sz - sz);
   }
-  p->sz = sz;
+  tg->sz = sz;
+  releasesleep(&tg->vmlock);
   return 0;
 }
 
@@ -249,21 +394,34 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct tgroup *tg = p->tg, *ntg;
+
+  // keep the process's other threads from changing its
+  // memory while it is copied.
+  acquiresleep(&tg->vmlock);
 
   // Allocate process.
-  if((np = allocproc()) == 0){
-    return -1;
+  if((np = allocproc()) == 0)
+    goto bad;
+  if(tgalloc(np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    goto bad;
   }
+  ntg = np->tg;
+
+  // np isn't runnable, so nothing else uses it; don't
+  // hold its lock, with interrupts off, during the copy.
+  release(&np->lock);
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(tg->pagetable, ntg->pagetable, tg->sz) < 0){
+    acquire(&np->lock);
     freeproc(np);
     release(&np->lock);
-    return -1;
+    goto bad;
   }
-  np->sz = p->sz;
-
-  np->parent = p;
+  ntg->sz = tg->sz;
 
   // copy saved user registers.
   *(np->tf) = *(p->tf);
@@ -271,21 +429,86 @@ fork(void)
   // Cause fork to return 0 in the child.
   np->tf->a0 = 0;
 
-  // increment reference counts on open file descriptors.
+  // increment reference counts on open file descriptors,
+  // while the other threads can't open or close any.
+  acquire(&tg->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+    if(tg->ofile[i])
+      ntg->ofile[i] = filedup(tg->ofile[i]);
+  ntg->cwd = idup(tg->cwd);
+  release(&tg->lock);
+  if(tg->execip)
+    ntg->execip = idup(tg->execip);
+  memmove(ntg->seg, tg->seg, sizeof(tg->seg));
+  ntg->nseg = tg->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
+  acquire(&np->lock);
+  np->parent = p;
   np->state = RUNNABLE;
-
   release(&np->lock);
+  releasesleep(&tg->vmlock);
 
   return pid;
+
+bad:
+  releasesleep(&tg->vmlock);
+  return -1;
+}
+
+// Create a thread of the current process that shares its
+// memory, open files and current directory, and starts at
+// user address fn with a0 = arg and sp = stack.
+// Returns the new thread's ID, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int slot, tid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
+
+  acquire(&tg->lock);
+  for(slot = 0; slot < NTHREAD; slot++)
+    if((tg->tfslots & (1 << slot)) == 0)
+      break;
+  if(tg->exiting || tg->execing || slot == NTHREAD || (np = allocproc()) == 0){
+    release(&tg->lock);
+    return -1;
+  }
+
+  // map the thread's trapframe in its slot. as in tgput(),
+  // this doesn't race with other threads' page-table changes.
+  if(mappages(tg->pagetable, TFSLOT(slot), PGSIZE, (uint64)np->tf, PTE_R | PTE_W) != 0){
+    freeproc(np);
+    release(&np->lock);
+    release(&tg->lock);
+    return -1;
+  }
+  tg->tfslots |= 1 << slot;
+  tg->ref++;
+  tg->nthread++;
+  np->tg = tg;
+  np->pagetable = tg->pagetable;
+  np->tfva = TFSLOT(slot);
+  release(&tg->lock);
+  uvmflush(p, np->tfva, PGSIZE);
+
+  np->parent = 0;
+  *(np->tf) = *(p->tf);
+  np->tf->epc = fn;
+  np->tf->a0 = arg;
+  np->tf->sp = stack;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  tid = np->pid;
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return tid;
 }
 
 // Pass p's abandoned children to init.
@@ -314,6 +537,170 @@ reparent(struct proc *p)
   }
 }
 
+// Exit the current thread, p, which isn't its process's
+// leader. Does not return. p remains in the zombie state
+// until another thread join()s it, or the leader exits.
+static void
+threadexit(struct proc *p, int status)
+{
+  struct tgroup *tg = p->tg;
+
+  // p's children go to init; see exit().
+  acquire(&initproc->lock);
+  wakeup1(initproc);
+  release(&initproc->lock);
+
+  acquire(&tg->lock);
+  tg->nthread--;
+
+  // join() or the leader's exit() might be waiting.
+  wakeup(tg);
+
+  // hold p->lock from before releasing tg->lock, so a
+  // thread that sees nthread go down also sees p a zombie.
+  acquire(&p->lock);
+  release(&tg->lock);
+
+  reparent(p);
+
+  p->xstate = status;
+  p->state = ZOMBIE;
+
+  sched();
+  panic("zombie exit");
+}
+
+// Exit the current thread. The leader first waits
+// for the other threads, then exits the process.
+void
+texit(int status)
+{
+  struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
+
+  if(p != tg->leader)
+    threadexit(p, status);
+
+  acquire(&tg->lock);
+  while(tg->nthread > 1 && !p->killed)
+    sleep(tg, &tg->lock);
+  release(&tg->lock);
+  exit(status);
+}
+
+// Wait for thread tid of the current process to exit,
+// and free it. Returns 0, or -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *q;
+  int found, xstate;
+  struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
+
+  // hold tg->lock for the whole time to avoid lost
+  // wakeups from threadexit().
+  acquire(&tg->lock);
+
+  for(;;){
+    found = 0;
+    for(q = proc; q < &proc[NPROC]; q++){
+      // q->tg only changes with tg->lock held, or when q
+      // is freed, so this check without q->lock is safe.
+      if(q == p || q->tg != tg || q == tg->leader)
+        continue;
+      acquire(&q->lock);
+      if(q->pid == tid){
+        found = 1;
+        if(q->state == ZOMBIE){
+          xstate = q->xstate;
+          freeproc(q);
+          release(&q->lock);
+          release(&tg->lock);
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
+          return 0;
+        }
+      }
+      release(&q->lock);
+    }
+
+    if(!found || p->killed){
+      release(&tg->lock);
+      return -1;
+    }
+
+    sleep(tg, &tg->lock);
+  }
+}
+
+// Kill p's other threads. Caller holds p->tg->lock.
+static void
+tgkill(struct proc *p)
+{
+  struct proc *q;
+
+  for(q = proc; q < &proc[NPROC]; q++){
+    if(q != p && q->tg == p->tg){
+      acquire(&q->lock);
+      q->killed = 1;
+      if(q->state == SLEEPING)
+        q->state = RUNNABLE;
+      release(&q->lock);
+    }
+  }
+}
+
+// Free p's other threads, once they have all exited and
+// ring work is done (uringstop()). p is the leader, and
+// holds p->tg->lock.
+static void
+tgreap(struct proc *p)
+{
+  struct proc *q;
+
+  for(q = proc; q < &proc[NPROC]; q++){
+    if(q != p && q->tg == p->tg){
+      acquire(&q->lock);
+      freeproc(q);
+      release(&q->lock);
+    }
+  }
+}
+
+// Make the current thread its process's only one, for
+// exec(): kill the other threads, wait for them, and free
+// them, joined or not. Returns 0, or -1 if the current
+// thread isn't the leader, or the process is exiting.
+int
+tgsolo(void)
+{
+  struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
+
+  acquire(&tg->lock);
+  if(p != tg->leader || tg->exiting || tg->execing){
+    release(&tg->lock);
+    return -1;
+  }
+  tg->execing = 1;   // no more clone()s
+  tgkill(p);
+  // another thread's exit() kills p.
+  while(tg->nthread > 1 && !p->killed)
+    sleep(tg, &tg->lock);
+  if(tg->nthread > 1){
+    tg->execing = 0;
+    release(&tg->lock);
+    return -1;
+  }
+  uringstop(tg);
+  tgreap(p);
+  tg->execing = 0;
+  release(&tg->lock);
+  return 0;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait().
@@ -321,23 +708,47 @@ void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
 
   if(p == initproc)
     panic("init exiting");
 
+  // Kill the process's other threads. The leader goes
+  // on once they are gone; the first exit() sets the
+  // process's exit status.
+  acquire(&tg->lock);
+  if(!tg->exiting){
+    tg->exiting = 1;
+    tg->xstate = status;
+  }
+  status = tg->xstate;
+  tgkill(p);
+  if(p != tg->leader){
+    release(&tg->lock);
+    threadexit(p, status);
+  }
+  while(tg->nthread > 1)
+    sleep(tg, &tg->lock);
+  uringstop(tg);
+  tgreap(p);
+  release(&tg->lock);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
+    if(tg->ofile[fd]){
+      struct file *f = tg->ofile[fd];
       fileclose(f);
-      p->ofile[fd] = 0;
+      tg->ofile[fd] = 0;
     }
   }
 
   begin_op(ROOTDEV);
-  iput(p->cwd);
+  iput(tg->cwd);
+  if(tg->execip)
+    iput(tg->execip);
   end_op(ROOTDEV);
-  p->cwd = 0;
+  tg->cwd = 0;
+  tg->execip = 0;
 
   // we might re-parent a child to init. we can't be precise about
   // waking up init, since we can't acquire its lock once we've
@@ -446,6 +857,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
   for(;;){
@@ -460,7 +872,7 @@ scheduler(void)
     int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
-      if(p->state == RUNNABLE) {
+      if(p->state == RUNNABLE && (p->cpu < 0 || p->cpu == id)) {
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
@@ -596,6 +1008,25 @@ wakeup(void *chan)
   }
 }
 
+// Wake up at most n processes sleeping on chan, and return
+// how many. Must be called without any p->lock.
+int
+wakeupn(void *chan, int n)
+{
+  struct proc *p;
+  int woken = 0;
+
+  for(p = proc; p < &proc[NPROC] && woken < n; p++) {
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      p->state = RUNNABLE;
+      woken++;
+    }
+    release(&p->lock);
+  }
+  return woken;
+}
+
 // Wake up p if it is sleeping in wait(); used by exit().
 // Caller must hold p->lock.
 static void
@@ -670,6 +1101,7 @@ procdump(void)
 {
   static char *states[] = {
   [UNUSED]    "unused",
+  [USED]      "used  ",
   [SLEEPING]  "sleep ",
   [RUNNABLE]  "runble",
   [RUNNING]   "run   ",
@@ -24,6 +24,8 @@ struct cpu {
   struct context scheduler;   // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB was flushed for.
+  volatile int tlbflush;      // Set by uvmshootdown(), cleared by devintr().
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,27 +82,86 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
-// Per-process state
+// A segment of the program exec() loaded, whose pages
+// uvmfault() reads from the program file on first touch.
+struct seg {
+  uint64 va;        // page-aligned start
+  uint64 fileend;   // end of the part read from the file
+  uint64 end;       // end; zero-filled from fileend on
+  uint off;         // offset of va in the file
+  int perm;         // PTE_R, PTE_W, PTE_X; shared if not PTE_W
+};
+
+// State shared by the threads of a process: its memory,
+// open files and current directory. Each thread is a
+// struct proc with its own kernel stack and trapframe,
+// and p->tg points here.
+struct tgroup {
+  struct spinlock lock;
+
+  // tg->lock must be held when using these:
+  int ref;                     // Threads, live or not yet joined
+  int nthread;                 // Live threads
+  int exiting;                 // A thread called exit()
+  int execing;                 // exec() is killing the other threads
+  int xstate;                  // Its exit status
+  uint tfslots;                // Trapframe slots in use, see TFSLOT()
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+
+  // tg->vmlock must be held to change these, and by uvmfault(),
+  // except in exec() and exit(), when there is one thread.
+  struct sleeplock vmlock;
+  uint64 sz;                   // Size of process memory (bytes)
+  pagetable_t pagetable;       // Page table
+  struct inode *execip;        // Program file, for demand paging
+  struct seg seg[NSEG];        // Demand-paged segments of the program
+  int nseg;
+  int ncopy;                   // Pages copyin() etc. are using (atomic)
+
+  struct uring *uring;         // Rings mapped at URING, or 0 (uring.c)
+  struct work *uringwork;      // Drains the rings in a worker thread
+  int uringbusy;               // uringwork queued or running (tg->lock)
+  int uringmore;               // More submissions since it started (tg->lock)
+  int uringstop;               // uringstop() wants it to finish
+  struct proc *uringproc;      // Worker acting for the group, or 0 (tg->lock)
+
+  struct proc *leader;         // Thread that fork() created; exits last
+  uint64 asid;                 // Address-space ID, if asidgen is current
+  uint64 asidgen;              // ASID generation; 0 if none yet
+  uint tlbcpus;                // CPUs that may cache TLB entries for asid
+  uint tlbstale;               // CPUs that must flush asid before running it
+};
+
+// Per-thread state
 struct proc {
   struct spinlock lock;
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
+  struct proc *parent;         // Parent process; 0 for a clone()d thread
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
-  int pid;                     // Process ID
+  int pid;                     // Process ID, or thread ID for clone()d threads
+  int cpu;                     // The only CPU to run on (kernel workers), or -1
 
-  // these are private to the process, so p->lock need not be held.
+  // these are private to the thread, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // Page table
+  struct tgroup *tg;           // Shared with the process's other threads
+  pagetable_t pagetable;       // tg->pagetable
   struct trapframe *tf;        // data page for trampoline.S
+  uint64 tfva;                 // where tf is mapped: TRAPFRAME, or a slot below
+  struct file *held[2];        // argfd()'s references, for syscall() to drop
+  int nheld;
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  void (*kfn)(void*);          // Kernel thread's function (kthread_create())
+  void *karg;                  // and its argument
   char name[16];               // Process name (debugging)
 };
+
+// The user address of trapframe slot i. Slot 0, at TRAPFRAME,
+// is the leader's; threads get the others, down to URING.
+#define TFSLOT(i) (TRAPFRAME - (uint64)(i)*PGSIZE)
@@ -1,5 +1,13 @@
 //
-// ramdisk that uses the disk image loaded by qemu -rdinit fs.img
+// RAM disk: disk device RAMDISKDEV, whose blocks are in memory
+// at RAMDISK, where qemu has loaded fs.img before the kernel
+// starts. The virtio disks keep their own device numbers.
+//
+// make RAMROOT=1 qemu ... -m 144M -device loader,file=fs.img,addr=RAMDISK
+//
+// Transfers are just memmove()s, with no device latency, so
+// benchmarks run on it measure the file system's own cost.
+// Writes go to the copy in memory, not to fs.img.
 //
 
 #include "types.h"
@@ -12,34 +20,38 @@
 #include "fs.h"
 #include "buf.h"
 
+static uint nblocks;  // blocks in the image, from its super block
+
+// Serve device n from the image at RAMDISK.
 void
-ramdiskinit(void)
+ramdiskinit(int n)
 {
+  struct superblock *sb = (struct superblock *)(RAMDISK + BSIZE);
+
+  if(sb->magic != FSMAGIC)
+    panic("ramdiskinit: no fs.img");
+  if((uint64)sb->size * BSIZE > RAMDISKSIZE)
+    panic("ramdiskinit: fs.img too big");
+  nblocks = sb->size;
+  printf("ramdisk init %d: %d blocks\n", n, nblocks);
+  bdevsw[n].rw = ramdiskrw;
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Read (write == 0) or write b. There is only one image,
+// so n names the device only for bdevsw[].
 void
-ramdiskrw(struct buf *b)
+ramdiskrw(int n, struct buf *b, int write)
 {
+  char *addr;
+
   if(!holdingsleep(&b->lock))
     panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
-
-  if(b->blockno >= FSSIZE)
+  if(b->blockno >= nblocks)
     panic("ramdiskrw: blockno too big");
 
-  uint64 diskaddr = b->blockno * BSIZE;
-  char *addr = (char *)RAMDISK + diskaddr;
-
-  if(b->flags & B_DIRTY){
-    // write
+  addr = (char *)RAMDISK + (uint64)b->blockno * BSIZE;
+  if(write)
     memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
-  } else {
-    // read
+  else
     memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
-  }
 }
@@ -0,0 +1,77 @@
+// Vector memmove, memset, memcmp and strlen, for
+// make RVV=1. string.c calls these when start() found
+// the V extension in misa.
+//
+// Processes never use the vector unit, so its registers
+// aren't saved on a context switch. Instead, each call
+// turns the unit on with interrupts off, so nothing else
+// can run on this CPU meanwhile, and turns it off again
+// before interrupts come back on.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+int rvv_present;    // set by start()
+
+// in rvvasm.S
+void vmemmove(void*, const void*, uint64);
+void vmemset(void*, int, uint64);
+int vmemcmp(const void*, const void*, uint64);
+uint64 vstrlen(const char*);
+
+static void
+vecbegin(void)
+{
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+}
+
+static void
+vecend(void)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
+
+void*
+rvv_memmove(void *dst, const void *src, uint n)
+{
+  vecbegin();
+  vmemmove(dst, src, n);
+  vecend();
+  return dst;
+}
+
+void*
+rvv_memset(void *dst, int c, uint n)
+{
+  vecbegin();
+  vmemset(dst, c, n);
+  vecend();
+  return dst;
+}
+
+int
+rvv_memcmp(const void *v1, const void *v2, uint n)
+{
+  int r;
+
+  vecbegin();
+  r = vmemcmp(v1, v2, n);
+  vecend();
+  return r;
+}
+
+int
+rvv_strlen(const char *s)
+{
+  int n;
+
+  vecbegin();
+  n = vstrlen(s);
+  vecend();
+  return n;
+}
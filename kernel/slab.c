@@ -0,0 +1,212 @@
+// Object caches for fixed-size kernel structures,
+// on top of the buddy allocator in buddy.c.
+//
+// A cache hands out objects of one size. It gets memory from
+// bd_malloc() a slab at a time: a power-of-two block of at least
+// a page, with a struct slab header at the start and the objects
+// after it. Buddy blocks are aligned to their size (kinit() lines
+// the heap up), so the slab holding an object is found by rounding
+// the object's address down to the slab size.
+//
+// Objects are constructed (ctor) once, when their slab is created,
+// and destroyed (dtor) when the slab goes back to the buddy
+// allocator, so an object keeps e.g. its initialized lock across
+// kmem_cache_free() and kmem_cache_alloc(). A free object's link
+// lives just past the object, not in it, for the same reason.
+//
+// Each CPU has a magazine of up to MAGSIZE free objects per cache.
+// kmem_cache_alloc() and kmem_cache_free() normally touch only the
+// current CPU's magazine, with interrupts off; the cache lock is
+// taken only to refill an empty magazine or drain a full one.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define MAGSIZE   16   // objects in a per-CPU magazine
+#define MINOBJS    8   // objects per slab, at least
+#define MAXEMPTY   1   // completely free slabs a cache holds on to
+
+struct slab {
+  struct list link;    // on the cache's partial or empty list
+  uint nfree;          // free objects in this slab
+  void *free;          // first free object
+};
+
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint objsize;        // bytes the caller asked for, rounded to 8
+  uint stride;         // object plus free link, rounded to 16
+  uint slabsize;       // bytes per slab, a power of two
+  uint nobj;           // objects per slab
+  void (*ctor)(void*);
+  void (*dtor)(void*);
+  struct list partial; // slabs with some objects free
+  struct list empty;   // slabs with all objects free
+  int nempty;
+  struct magazine mag[NCPU];
+};
+
+// the free-list link of object o.
+#define OBJLINK(c, o) (*(void**)((char*)(o) + (c)->objsize))
+
+// Create a cache of objects of size bytes.
+// ctor and dtor may be 0.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*), void (*dtor)(void*))
+{
+  struct kmem_cache *c;
+
+  if((c = bd_malloc(sizeof(*c))) == 0)
+    panic("kmem_cache_create");
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->objsize = (size + 7) & ~7;
+  c->stride = (c->objsize + sizeof(void*) + 15) & ~15;
+  for(c->slabsize = PGSIZE; (c->slabsize - SLABHDR) / c->stride < MINOBJS; c->slabsize *= 2)
+    ;
+  c->nobj = (c->slabsize - SLABHDR) / c->stride;
+  c->ctor = ctor;
+  c->dtor = dtor;
+  lst_init(&c->partial);
+  lst_init(&c->empty);
+  return c;
+}
+
+// Get a new slab from the buddy allocator and
+// construct its objects. Caller holds c->lock.
+static struct slab*
+slab_create(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = bd_malloc(c->slabsize)) == 0)
+    return 0;
+  s->nfree = c->nobj;
+  s->free = 0;
+  for(i = c->nobj - 1; i >= 0; i--){
+    o = (char*)s + SLABHDR + i*c->stride;
+    if(c->ctor)
+      c->ctor(o);
+    OBJLINK(c, o) = s->free;
+    s->free = o;
+  }
+  return s;
+}
+
+// Destroy the objects of a free slab and give it back
+// to the buddy allocator. Caller holds c->lock.
+static void
+slab_destroy(struct kmem_cache *c, struct slab *s)
+{
+  int i;
+
+  if(c->dtor){
+    for(i = 0; i < c->nobj; i++)
+      c->dtor((char*)s + SLABHDR + i*c->stride);
+  }
+  bd_free(s);
+}
+
+// Move up to half a magazine of objects from the
+// cache's slabs into m.
+static void
+refill(struct kmem_cache *c, struct magazine *m)
+{
+  struct slab *s;
+  void *o;
+
+  acquire(&c->lock);
+  while(m->n < MAGSIZE/2){
+    if(lst_empty(&c->partial)){
+      if(!lst_empty(&c->empty)){
+        s = lst_pop(&c->empty);
+        c->nempty--;
+      } else if((s = slab_create(c)) == 0){
+        break;
+      }
+      lst_push(&c->partial, s);
+    }
+    s = (struct slab*)c->partial.next;
+    o = s->free;
+    s->free = OBJLINK(c, o);
+    m->obj[m->n++] = o;
+    if(--s->nfree == 0)
+      lst_remove(&s->link);   // full slabs are on no list
+  }
+  release(&c->lock);
+}
+
+// Return n objects from m to their slabs.
+static void
+drain(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *o;
+
+  acquire(&c->lock);
+  while(n-- > 0 && m->n > 0){
+    o = m->obj[--m->n];
+    s = (struct slab*)((uint64)o & ~((uint64)c->slabsize - 1));
+    OBJLINK(c, o) = s->free;
+    s->free = o;
+    if(s->nfree++ == 0)
+      lst_push(&c->partial, s);
+    if(s->nfree == c->nobj){
+      lst_remove(&s->link);
+      if(c->nempty < MAXEMPTY){
+        lst_push(&c->empty, s);
+        c->nempty++;
+      } else {
+        slab_destroy(c, s);
+      }
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate an object from cache c.
+// Returns 0 if memory is exhausted.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *o = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0)
+    refill(c, m);
+  if(m->n > 0)
+    o = m->obj[--m->n];
+  pop_off();
+  return o;
+}
+
+// Free an object that kmem_cache_alloc(c) returned.
+void
+kmem_cache_free(struct kmem_cache *c, void *o)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE)
+    drain(c, m, MAGSIZE/2);
+  m->obj[m->n++] = o;
+  pop_off();
+}
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -13,7 +14,11 @@
 static int nlock;
 static struct spinlock *locks[NLOCK];
 
-// assumes locks are not freed
+// protects nlock and locks[]. not itself in locks[].
+static struct spinlock lockslock = { .name = "locks" };
+
+// locks that live in freed memory (e.g. in objects of a
+// slab.c cache) must be passed to freelock() first.
 void
 initlock(struct spinlock *lk, char *name)
 {
@@ -22,10 +27,29 @@ initlock(struct spinlock *lk, char *name)
   lk->cpu = 0;
   lk->nts = 0;
   lk->n = 0;
+  acquire(&lockslock);
   if(nlock >= NLOCK)
     panic("initlock");
   locks[nlock] = lk;
   nlock++;
+  release(&lockslock);
+}
+
+// Forget about a lock whose memory is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  int i;
+
+  acquire(&lockslock);
+  for(i = 0; i < nlock; i++){
+    if(locks[i] == lk){
+      locks[i] = locks[--nlock];
+      locks[nlock] = 0;
+      break;
+    }
+  }
+  release(&lockslock);
 }
 
 // Acquire the lock.
@@ -140,6 +164,7 @@ sys_ntas(void)
   if (argint(0, &zero) < 0) {
     return -1;
   }
+  acquire(&lockslock);
   if(zero == 0) {
     for(int i = 0; i < NLOCK; i++) {
       if(locks[i] == 0)
@@ -147,6 +172,7 @@ sys_ntas(void)
       locks[i]->nts = 0;
       locks[i]->n = 0;
     }
+    release(&lockslock);
     return 0;
   }
 
@@ -176,5 +202,6 @@ sys_ntas(void)
     print_lock(locks[top]);
     last = locks[top]->nts;
   }
+  release(&lockslock);
   return tot;
 }
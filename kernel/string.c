@@ -1,49 +1,46 @@
 #include "types.h"
+#include "memops.h"
+#ifdef RVV
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+// with RVV, the vector versions in rvv.c take over
+// once n is big enough to pay for turning the vector
+// unit on and off.
+#define RVVMIN 64
+#endif
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
+#ifdef RVV
+  if(rvv_present && n >= RVVMIN)
+    return rvv_memset(dst, c, n);
+#endif
+  memops_set(dst, c, n);
   return dst;
 }
 
 int
 memcmp(const void *v1, const void *v2, uint n)
 {
-  const uchar *s1, *s2;
-
-  s1 = v1;
-  s2 = v2;
-  while(n-- > 0){
-    if(*s1 != *s2)
-      return *s1 - *s2;
-    s1++, s2++;
-  }
-
-  return 0;
+#ifdef RVV
+  if(rvv_present && n >= RVVMIN)
+    return rvv_memcmp(v1, v2, n);
+#endif
+  return memops_cmp(v1, v2, n);
 }
 
 void*
 memmove(void *dst, const void *src, uint n)
 {
-  const char *s;
-  char *d;
-
-  s = src;
-  d = dst;
-  if(s < d && s + n > d){
-    s += n;
-    d += n;
-    while(n-- > 0)
-      *--d = *--s;
-  } else
-    while(n-- > 0)
-      *d++ = *s++;
-
+#ifdef RVV
+  if(rvv_present && n >= RVVMIN)
+    return rvv_memmove(dst, src, n);
+#endif
+  memops_move(dst, src, n);
   return dst;
 }
 
@@ -97,6 +94,10 @@ strlen(const char *s)
 {
   int n;
 
+#ifdef RVV
+  if(rvv_present)
+    return rvv_strlen(s);
+#endif
   for(n = 0; s[n]; n++)
     ;
   return n;
@@ -23,3 +23,25 @@
 
 // System calls for labs
 #define SYS_ntas   22
+#define SYS_bdbench 23
+#define SYS_fcntl  24
+#define SYS_splice 25
+#define SYS_tee    26
+#define SYS_dmesg  27
+#define SYS_clone  28
+#define SYS_texit  29
+#define SYS_join   30
+#define SYS_futex_wait 31
+#define SYS_futex_wake 32
+#define SYS_poll   33
+#define SYS_pipe2  34
+#define SYS_readv  35
+#define SYS_writev 36
+#define SYS_pread  37
+#define SYS_pwrite 38
+#define SYS_lseek  39
+#define SYS_copy_file_range 40
+#define SYS_uring_setup 41
+#define SYS_uring_enter 42
+#define SYS_fsync  43
+#define SYS_sync   44
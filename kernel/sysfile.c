@@ -10,11 +10,13 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -23,11 +25,24 @@ argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
 
-  if(argint(n, &fd) < 0)
+  if(argint(n, &fd) < 0 || fd < 0 || fd >= NOFILE)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  acquire(&tg->lock);
+  if((f = tg->ofile[fd]) == 0){
+    release(&tg->lock);
     return -1;
+  }
+  // another thread might close fd while the system call
+  // uses f; syscall() drops this reference afterwards.
+  if(tg->nthread > 1){
+    if(p->nheld == NELEM(p->held))
+      panic("argfd");
+    p->held[p->nheld++] = filedup(f);
+  }
+  release(&tg->lock);
   if(pfd)
     *pfd = fd;
   if(pf)
@@ -41,17 +56,38 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct tgroup *tg = myproc()->tg;
 
+  acquire(&tg->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(tg->ofile[fd] == 0){
+      tg->ofile[fd] = f;
+      release(&tg->lock);
       return fd;
     }
   }
+  release(&tg->lock);
   return -1;
 }
 
+// Remove descriptor fd, which refers to f, leaving the file
+// reference to the caller. Returns -1 if another thread
+// has closed fd meanwhile.
+static int
+fdrelease(int fd, struct file *f)
+{
+  struct tgroup *tg = myproc()->tg;
+
+  acquire(&tg->lock);
+  if(tg->ofile[fd] != f){
+    release(&tg->lock);
+    return -1;
+  }
+  tg->ofile[fd] = 0;
+  release(&tg->lock);
+  return 0;
+}
+
 uint64
 sys_dup(void)
 {
@@ -91,15 +127,121 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the iovec array and its length, syscall arguments
+// n and n+1, into iov. Returns the number of segments.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 addr;
+  int i, cnt;
+  uint64 tot;
+
+  if(argaddr(n, &addr) < 0 || argint(n+1, &cnt) < 0)
+    return -1;
+  if(cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, cnt * sizeof(iov[0])) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    tot += iov[i].len;
+    if(iov[i].len > MAXFILE*BSIZE || tot > MAXFILE*BSIZE)
+      return -1;
+  }
+  return cnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov)) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov)) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+// wait until fd's file data is on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+// commit everything written so far, and write
+// all of it to its home on disk.
+uint64
+sys_sync(void)
+{
+  log_sync(-1, 1);
+  return 0;
+}
+
 uint64
 sys_close(void)
 {
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argfd(0, &fd, &f) < 0 || fdrelease(fd, f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -115,6 +257,77 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipegetsize(f->pipe);
+  case F_SETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesetsize(f->pipe, arg);
+  case F_GETFL:
+    if(f->readable && f->writable)
+      arg = O_RDWR;
+    else if(f->writable)
+      arg = O_WRONLY;
+    else
+      arg = O_RDONLY;
+    return arg | (filenonblock(f) ? O_NONBLOCK : 0);
+  case F_SETFL:
+    filesetnonblock(f, arg & O_NONBLOCK);
+    return 0;
+  }
+  return -1;
+}
+
+// Move up to n bytes from fd in to fd out, one of
+// them a pipe, without copying through user space.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// Copy up to n bytes from pipe in to pipe out,
+// leaving them in in.
+uint64
+sys_tee(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filetee(in, out, n);
+}
+
+// Copy up to n bytes from file fd in to file fd out
+// without copying through user space.
+uint64
+sys_copy_file_range(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filecopy(in, out, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -283,17 +496,14 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-uint64
-sys_open(void)
+// Open path with the O_ flags in omode, for open()
+// and uring_enter(). Returns the new fd.
+int
+fileopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op(ROOTDEV);
 
@@ -309,7 +519,7 @@ sys_open(void)
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ip->type == T_DIR && (omode & (O_WRONLY|O_RDWR))){
       iunlockput(ip);
       end_op(ROOTDEV);
       return -1;
@@ -341,6 +551,7 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   iunlock(ip);
   end_op(ROOTDEV);
@@ -348,6 +559,17 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return fileopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -388,7 +610,7 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
+  struct inode *ip, *old;
   struct proc *p = myproc();
   
   begin_op(ROOTDEV);
@@ -403,9 +625,12 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&p->tg->lock);
+  old = p->tg->cwd;
+  p->tg->cwd = ip;
+  release(&p->tg->lock);
+  iput(old);
   end_op(ROOTDEV);
-  p->cwd = ip;
   return 0;
 }
 
@@ -452,30 +677,32 @@ sys_exec(void)
   return -1;
 }
 
-uint64
-sys_pipe(void)
+// make a pipe, with the O_ flags in flags (only
+// O_NONBLOCK), and put its fds in fdarray.
+static int
+makepipe(uint64 fdarray, int flags)
 {
-  uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
   struct proc *p = myproc();
 
-  if(argaddr(0, &fdarray) < 0)
+  if(flags & ~O_NONBLOCK)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
+  rf->nonblock = wf->nonblock = (flags & O_NONBLOCK) != 0;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdrelease(fd0, rf);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdrelease(fd0, rf);
+    fdrelease(fd1, wf);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -483,3 +710,80 @@ sys_pipe(void)
   return 0;
 }
 
+uint64
+sys_pipe(void)
+{
+  uint64 fdarray; // user pointer to array of two integers
+
+  if(argaddr(0, &fdarray) < 0)
+    return -1;
+  return makepipe(fdarray, 0);
+}
+
+uint64
+sys_pipe2(void)
+{
+  uint64 fdarray;
+  int flags;
+
+  if(argaddr(0, &fdarray) < 0 || argint(1, &flags) < 0)
+    return -1;
+  return makepipe(fdarray, flags);
+}
+
+
+// wait for one of nfds files to be ready, or for timeout
+// ticks (forever if negative); return how many are ready.
+uint64
+sys_poll(void)
+{
+  struct pollfd fds[NOFILE];
+  struct file *f[NOFILE];
+  struct tgroup *tg = myproc()->tg;
+  uint64 addr;
+  int i, n, timeout, r;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)fds, addr, n * sizeof(fds[0])) < 0)
+    return -1;
+
+  // hold the files while waiting, in case another
+  // thread closes the descriptors.
+  acquire(&tg->lock);
+  for(i = 0; i < n; i++){
+    f[i] = 0;
+    if(fds[i].fd >= 0 && fds[i].fd < NOFILE && tg->ofile[fds[i].fd])
+      f[i] = filedup(tg->ofile[fds[i].fd]);
+  }
+  release(&tg->lock);
+
+  r = poll(f, fds, n, timeout);
+
+  for(i = 0; i < n; i++)
+    if(f[i])
+      fileclose(f[i]);
+  if(r >= 0 && copyout(myproc()->pagetable, addr, (char*)fds, n * sizeof(fds[0])) < 0)
+    return -1;
+  return r;
+}
+
+// map the shared rings of uring_enter(); return their address.
+uint64
+sys_uring_setup(void)
+{
+  return uringsetup();
+}
+
+// start the queued submissions; wait for min completions.
+uint64
+sys_uring_enter(void)
+{
+  int min;
+
+  if(argint(0, &min) < 0)
+    return -1;
+  return uringenter(min);
+}
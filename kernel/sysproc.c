@@ -5,6 +5,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 
 uint64
@@ -35,6 +36,9 @@ sys_wait(void)
   uint64 p;
   if(argaddr(0, &p) < 0)
     return -1;
+  // wait() copies out the status with locks held,
+  // so it can't fault the page in itself.
+  uvmprefault(myproc(), p, sizeof(int));
   return wait(p);
 }
 
@@ -46,8 +50,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if(growproc(n, &addr) < 0)
     return -1;
   return addr;
 }
@@ -95,3 +98,73 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// copy up to n kernel log records, oldest first,
+// to the user buffer; return how many.
+uint64
+sys_dmesg(void)
+{
+  uint64 p;
+  int n;
+
+  if(argaddr(0, &p) < 0 || argint(1, &n) < 0)
+    return -1;
+  return klogread(p, n);
+}
+
+// start a thread at fn(arg), with stack pointer stack;
+// return its thread ID.
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_texit(void)
+{
+  int n;
+  if(argint(0, &n) < 0)
+    return -1;
+  texit(n);
+  return 0;  // not reached
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return join(tid, p);
+}
+
+// sleep if the int at addr holds val, until futex_wake(addr).
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+// wake up to n threads in futex_wait(addr).
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
@@ -0,0 +1,260 @@
+// Cache of programs' read-only pages, shared by every
+// process that runs the same program.
+//
+// uvmfault() gets a page of a program's read-only (text)
+// segment with textget(), which looks it up by (dev, inum,
+// offset) and reads it from the program file only if it isn't
+// cached. The page is mapped read-only with PTE_TEXT set, so
+// that uvmunmap() and uvmcopy() call textput() and textdup()
+// instead of freeing or copying it. A page stays cached after
+// its last mapping goes away, so exec()ing the same program
+// again reads nothing from disk; up to NTEXT pages are cached,
+// and the least recently used unmapped one is evicted first.
+//
+// Writing to or freeing a file invalidates its cached pages
+// (textinval()). Pages that are still mapped stay with their
+// processes until unmapped, but are no longer found. textget()
+// sets ip->text, and fs.c calls textinval() only for inodes
+// with it set, so writes to other files never take text.lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NHASH 31
+
+struct textpage {
+  uint dev;
+  uint inum;
+  uint off;               // offset of the page in the file
+  uint64 pa;              // the page; 0 if this entry is free
+  int ref;                // page tables mapping pa
+  int dead;               // invalidated while mapped
+  uint64 used;            // text.clock at the last textget()
+  struct textpage *inext; // chain in text.ihash[], by dev and inum
+  struct textpage *pnext; // chain in text.phash[], by pa
+};
+
+static struct {
+  struct spinlock lock;
+  struct textpage page[NTEXT];
+  struct textpage *ihash[NHASH];
+  struct textpage *phash[NHASH];
+  uint64 clock;
+  uint64 gen[NHASH];      // textinval() calls per ihash[] chain, to catch
+                          // races with textget()
+} text;
+
+#define IHASH(dev, inum) (((dev) * 7 + (inum)) % NHASH)
+#define PHASH(pa) (((pa) / PGSIZE) % NHASH)
+
+void
+textinit(void)
+{
+  initlock(&text.lock, "text");
+}
+
+// Find the cached page of (dev, inum) at off.
+// Caller holds text.lock.
+static struct textpage*
+lookup(uint dev, uint inum, uint off)
+{
+  struct textpage *t;
+
+  for(t = text.ihash[IHASH(dev, inum)]; t; t = t->inext)
+    if(t->dev == dev && t->inum == inum && t->off == off)
+      return t;
+  return 0;
+}
+
+// Find the entry of page pa. Caller holds text.lock.
+static struct textpage*
+pfind(uint64 pa)
+{
+  struct textpage *t;
+
+  for(t = text.phash[PHASH(pa)]; t; t = t->pnext)
+    if(t->pa == pa)
+      return t;
+  return 0;
+}
+
+// Remove t from its chain in text.phash[] and, if ichain
+// isn't 0, from ichain. Caller holds text.lock.
+static void
+unchain(struct textpage *t, struct textpage **ichain)
+{
+  struct textpage **pp;
+
+  if(ichain){
+    for(pp = ichain; *pp != t; pp = &(*pp)->inext)
+      ;
+    *pp = t->inext;
+  }
+  for(pp = &text.phash[PHASH(t->pa)]; *pp != t; pp = &(*pp)->pnext)
+    ;
+  *pp = t->pnext;
+}
+
+// Return a free entry, evicting the least recently
+// used unmapped page if there is none. Returns 0 if
+// every page is mapped. Caller holds text.lock.
+static struct textpage*
+allocent(void)
+{
+  struct textpage *t, *lru;
+
+  lru = 0;
+  for(t = text.page; t < text.page + NTEXT; t++){
+    if(t->pa == 0)
+      return t;
+    if(t->ref == 0 && (lru == 0 || t->used < lru->used))
+      lru = t;
+  }
+  if(lru){
+    unchain(lru, &text.ihash[IHASH(lru->dev, lru->inum)]);
+    kfree((void*)lru->pa);
+    lru->pa = 0;
+  }
+  return lru;
+}
+
+// Return the physical address of a page holding the n bytes
+// of ip at off, zero-filled after that, and count one more
+// mapping of it. Reads the page from ip if it isn't cached.
+// ip must not be locked. Returns 0 if out of memory, if the
+// read fails, or if ip was written meanwhile.
+uint64
+textget(struct inode *ip, uint off, uint n)
+{
+  struct textpage *t;
+  uint64 gen, pa;
+  uint h = IHASH(ip->dev, ip->inum);
+  char *mem;
+
+  acquire(&text.lock);
+  if((t = lookup(ip->dev, ip->inum, off)) != 0){
+    t->ref++;
+    t->used = ++text.clock;
+    release(&text.lock);
+    return t->pa;
+  }
+  gen = text.gen[h];
+  release(&text.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  ilock(ip);
+  ip->text = 1;
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  iunlock(ip);
+  memset(mem + n, 0, PGSIZE - n);
+
+  pa = 0;
+  acquire(&text.lock);
+  if((t = lookup(ip->dev, ip->inum, off)) == 0 && text.gen[h] == gen && (t = allocent()) != 0){
+    t->dev = ip->dev;
+    t->inum = ip->inum;
+    t->off = off;
+    t->pa = (uint64)mem;
+    t->ref = 0;
+    t->dead = 0;
+    t->inext = text.ihash[h];
+    text.ihash[h] = t;
+    t->pnext = text.phash[PHASH(t->pa)];
+    text.phash[PHASH(t->pa)] = t;
+    mem = 0;
+  }
+  if(t){
+    t->ref++;
+    t->used = ++text.clock;
+    pa = t->pa;
+  }
+  release(&text.lock);
+  if(mem)
+    kfree(mem);
+  return pa;
+}
+
+// Does (dev, inum) have cached pages? For ilock(),
+// when it reads an inode back into the inode cache.
+int
+textcached(uint dev, uint inum)
+{
+  struct textpage *t;
+  int found;
+
+  found = 0;
+  acquire(&text.lock);
+  for(t = text.ihash[IHASH(dev, inum)]; t; t = t->inext)
+    if(t->dev == dev && t->inum == inum)
+      found = 1;
+  release(&text.lock);
+  return found;
+}
+
+// Count another mapping of cached page pa, for fork().
+void
+textdup(uint64 pa)
+{
+  struct textpage *t;
+
+  acquire(&text.lock);
+  if((t = pfind(pa)) == 0)
+    panic("textdup");
+  t->ref++;
+  release(&text.lock);
+}
+
+// Drop a mapping of cached page pa.
+void
+textput(uint64 pa)
+{
+  struct textpage *t;
+
+  acquire(&text.lock);
+  if((t = pfind(pa)) == 0 || t->ref < 1)
+    panic("textput");
+  if(--t->ref == 0 && t->dead){
+    unchain(t, 0);
+    kfree((void*)t->pa);
+    t->pa = 0;
+  }
+  release(&text.lock);
+}
+
+// The file (dev, inum) is being written or freed:
+// forget its cached pages.
+void
+textinval(uint dev, uint inum)
+{
+  struct textpage *t, **pp;
+
+  acquire(&text.lock);
+  text.gen[IHASH(dev, inum)]++;
+  for(pp = &text.ihash[IHASH(dev, inum)]; (t = *pp) != 0; ){
+    if(t->dev != dev || t->inum != inum){
+      pp = &t->inext;
+      continue;
+    }
+    *pp = t->inext;
+    if(t->ref == 0){
+      unchain(t, 0);
+      kfree((void*)t->pa);
+      t->pa = 0;
+    } else {
+      t->dead = 1;
+    }
+  }
+  release(&text.lock);
+}
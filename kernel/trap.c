@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -16,6 +17,9 @@ void kernelvec();
 
 extern int devintr();
 
+// in start.c, shared with timervec.
+extern uint64 mscratch0[];
+
 static const char *
 scause_desc(uint64 stval);
 
@@ -52,8 +56,13 @@ usertrap(void)
   
   // save user program counter.
   p->tf->epc = r_sepc();
+
+  // save the trap cause, since uvmfault() turns
+  // interrupts on, and one would overwrite them.
+  uint64 scause = r_scause();
+  uint64 stval = r_stval();
   
-  if(r_scause() == 8){
+  if(scause == 8){
     // system call
 
     if(p->killed)
@@ -70,9 +79,13 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((scause == 12 || scause == 13 || scause == 15) &&
+            (intr_on(), uvmfault(p, stval, scause == 12 ? PTE_X : scause == 13 ? PTE_R : PTE_W)) == 0){
+    // an instruction, load or store page fault on a
+    // page of the program that hadn't been read in yet.
   } else {
-    printf("usertrap(): unexpected scause %p (%s) pid=%d\n", r_scause(), scause_desc(r_scause()), p->pid);
-    printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
+    printf("usertrap(): unexpected scause %p (%s) pid=%d\n", scause, scause_desc(scause), p->pid);
+    printf("            sepc=%p stval=%p\n", p->tf->epc, stval);
     p->killed = 1;
   }
 
@@ -120,14 +133,14 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->tf->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table, and its ASID, to switch to.
+  uint64 satp = uvmsatp(p);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -167,9 +180,20 @@ clockintr()
   acquire(&tickslock);
   ticks++;
   wakeup(&ticks);
+  polltick();
+  logtick();
   release(&tickslock);
 }
 
+// Interrupt CPU id: timervec turns the machine-mode software
+// interrupt into a supervisor one, and devintr() there does
+// what the CPU's struct cpu asks for.
+void
+ipi(int id)
+{
+  *(uint32*)CLINT_MSIP(id) = 1;
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -201,16 +225,30 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or inter-processor interrupt, forwarded by timervec in
+    // kernelvec.S.
+
+    // acknowledge the software interrupt by clearing
+    // the SSIP bit in sip, before looking at the reasons.
+    w_sip(r_sip() & ~2);
+
+    struct cpu *c = mycpu();
+    if(c->tlbflush){
+      // uvmshootdown() is waiting for this.
+      sfence_vma();
+      __sync_synchronize();
+      c->tlbflush = 0;
+    }
+
+    // timervec sets scratch[7] on a timer interrupt.
+    if(__sync_lock_test_and_set(&mscratch0[32 * cpuid() + 7], 0) == 0)
+      return 1;
 
     if(cpuid() == 0){
       clockintr();
+      klogflush();
     }
-    
-    // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
-    w_sip(r_sip() & ~2);
 
     return 2;
   } else {
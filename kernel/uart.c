@@ -7,6 +7,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -27,9 +28,27 @@
 #define LCR 3 // line control register
 #define LSR 5 // line status register
 
+#define IER_RX_ENABLE (1<<0)
+#define IER_TX_ENABLE (1<<1)
+#define LSR_RX_READY  (1<<0)  // input is waiting to be read from RHR
+#define LSR_TX_IDLE   (1<<5)  // the transmit FIFO is empty
+
+#define TXFIFO 16   // bytes the 16550's transmit FIFO holds
+
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
+// output waiting for the transmit FIFO. uartstart()
+// moves it to the FIFO whenever the FIFO is empty,
+// and uartintr() calls uartstart() when it drains.
+static struct {
+  struct spinlock lock;
+#define TXBUF 1024
+  char buf[TXBUF];
+  uint r;  // Read index; next byte to send
+  uint w;  // Write index
+} tx;
+
 void
 uartinit(void)
 {
@@ -49,29 +68,109 @@ uartinit(void)
   // and set word length to 8 bits, no parity.
   WriteReg(LCR, 0x03);
 
-  // reset and enable FIFOs.
+  // reset and enable the receive and transmit FIFOs.
   WriteReg(FCR, 0x07);
 
-  // enable receive interrupts.
-  WriteReg(IER, 0x01);
+  // enable receive interrupts, and transmit interrupts
+  // for when the transmit FIFO empties.
+  WriteReg(IER, IER_RX_ENABLE | IER_TX_ENABLE);
+
+  initlock(&tx.lock, "uart");
+}
+
+// if the transmit FIFO is empty, refill it from tx.buf.
+// caller holds tx.lock. doesn't wake up writers waiting
+// for room in tx.buf, since uartputc() may be called
+// with a p->lock held; uartintr() and uartwrite() do.
+static void
+uartstart(void)
+{
+  int i;
+
+  if(tx.r == tx.w || (ReadReg(LSR) & LSR_TX_IDLE) == 0)
+    return;
+  for(i = 0; i < TXFIFO && tx.r != tx.w; i++)
+    WriteReg(THR, tx.buf[tx.r++ % TXBUF]);
 }
 
-// write one output character to the UART.
+// add one output character to tx.buf, for printf()
+// and echoing input. doesn't sleep or wake anyone up,
+// so it can be called from interrupts and with locks
+// held; if tx.buf is full, it waits for the FIFO by
+// polling.
 void
 uartputc(int c)
 {
-  // wait for Transmit Holding Empty to be set in LSR.
-  while((ReadReg(LSR) & (1 << 5)) == 0)
+  acquire(&tx.lock);
+  while(tx.w == tx.r + TXBUF){
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    uartstart();
+  }
+  tx.buf[tx.w++ % TXBUF] = c;
+  uartstart();
+  release(&tx.lock);
+}
+
+// add n output characters to tx.buf, for write()s to
+// the console. sleeps while tx.buf is full, unless
+// nonblock is set. returns how many were added.
+int
+uartwrite(char *buf, int n, int nonblock)
+{
+  int i;
+
+  acquire(&tx.lock);
+  for(i = 0; i < n; i++){
+    while(tx.w == tx.r + TXBUF){
+      uartstart();
+      if(nonblock)
+        goto done;
+      sleep(&tx.r, &tx.lock);
+    }
+    tx.buf[tx.w++ % TXBUF] = buf[i];
+  }
+done:
+  uartstart();
+  wakeup(&tx.r);
+  release(&tx.lock);
+  return i;
+}
+
+// send one character by polling, without tx.lock, for
+// printf() before printfinit() and during panic(), when
+// taking a lock may deadlock or panic again. sends what
+// is in tx.buf first, so output stays in order.
+void
+uartputc_sync(int c)
+{
+  uartflush();
+  while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
     ;
   WriteReg(THR, c);
 }
 
+// send everything in tx.buf by polling, for panic(),
+// which doesn't return to take any more interrupts.
+void
+uartflush(void)
+{
+  int i;
+
+  while(tx.r != tx.w){
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    for(i = 0; i < TXFIFO && tx.r != tx.w; i++)
+      WriteReg(THR, tx.buf[tx.r++ % TXBUF]);
+  }
+}
+
 // read one input character from the UART.
 // return -1 if none is waiting.
 int
 uartgetc(void)
 {
-  if(ReadReg(LSR) & 0x01){
+  if(ReadReg(LSR) & LSR_RX_READY){
     // input data is ready.
     return ReadReg(RHR);
   } else {
@@ -79,14 +178,25 @@ uartgetc(void)
   }
 }
 
-// trap.c calls here when the uart interrupts.
+// trap.c calls here when the uart interrupts,
+// because input has arrived, or the transmit FIFO
+// is empty, or both.
 void
 uartintr(void)
 {
+  // acknowledge the interrupt; reading ISR clears
+  // a transmit interrupt.
+  ReadReg(ISR);
+
   while(1){
     int c = uartgetc();
     if(c == -1)
       break;
     consoleintr(c);
   }
+
+  acquire(&tx.lock);
+  uartstart();
+  wakeup(&tx.r);
+  release(&tx.lock);
 }
@@ -0,0 +1,7 @@
+// readv() and writev() take an array of segments.
+#define IOV_MAX 16  // most segments in one call
+
+struct iovec {
+  void *base;
+  uint64 len;
+};
@@ -0,0 +1,250 @@
+// Batched system calls through shared-memory rings (uring.h).
+//
+// uring_setup() maps a zeroed page at URING, holding a ring
+// of submissions and a ring of completions. A process queues
+// many reads, writes and opens there, and one uring_enter()
+// trap hands them all to a kernel worker (work.c), which
+// carries them out while the process goes on running, and
+// posts each completion as it finishes. The worker is one of
+// the WQ_USER pool's, since an operation may wait for a pipe
+// or the console; that holds up other rings' work on its CPU,
+// but not the kernel's own (the log flusher, page zeroing).
+// Operations use the ordinary, synchronous file calls. uring_enter() can
+// also wait for completions, so a process can submit and
+// reap a batch with one trap.
+//
+// The worker acts for the thread group: while it drains the
+// rings its p->tg and p->pagetable are the group's, so file
+// operations see the group's files and memory. Only one worker
+// at a time does a group's ring work (tg->uringbusy). exit()
+// and exec() stop it with uringstop() before they take the
+// files and memory away.
+//
+// The page belongs to the thread group; it is unmapped and
+// freed with the rest of the address space (proc_freepagetable()).
+// The process can change any of it at any time, so the kernel
+// copies each submission before looking at it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "uring.h"
+#include "work.h"
+#include "defs.h"
+
+static void uringwork(void*);
+
+// Map the rings, if they aren't already.
+// Returns their user address.
+uint64
+uringsetup(void)
+{
+  struct tgroup *tg = myproc()->tg;
+  char *mem;
+
+  acquiresleep(&tg->vmlock);
+  if(tg->uringwork == 0){
+    if((tg->uringwork = bd_malloc(sizeof(struct work))) == 0){
+      releasesleep(&tg->vmlock);
+      return -1;
+    }
+    initwork(tg->uringwork, WQ_USER, uringwork, tg);
+  }
+  if(tg->uring == 0){
+    if((mem = kzalloc()) == 0){
+      releasesleep(&tg->vmlock);
+      return -1;
+    }
+    if(mappages(tg->pagetable, URING, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+      kfree(mem);
+      releasesleep(&tg->vmlock);
+      return -1;
+    }
+    tg->uring = (struct uring*)mem;
+    uvmflush(myproc(), URING, PGSIZE);
+  }
+  releasesleep(&tg->vmlock);
+  return URING;
+}
+
+// Carry out submission e; return its result.
+// Runs in the worker, acting for the thread group.
+static int
+uringop(struct usqe *e)
+{
+  char path[MAXPATH];
+  struct tgroup *tg = myproc()->tg;
+  struct file *f;
+  int r;
+
+  if(e->op == UR_NOP)
+    return 0;
+  if(e->op == UR_OPEN){
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return fileopen(path, e->n);
+  }
+
+  if(e->fd < 0 || e->fd >= NOFILE || e->n < 0)
+    return -1;
+  acquire(&tg->lock);
+  f = tg->ofile[e->fd] ? filedup(tg->ofile[e->fd]) : 0;
+  release(&tg->lock);
+  if(f == 0)
+    return -1;
+  switch(e->op){
+  case UR_READ:
+    if(e->off < 0)
+      r = fileread(f, e->addr, e->n);
+    else
+      r = filepread(f, e->addr, e->n, e->off);
+    break;
+  case UR_WRITE:
+    if(e->off < 0)
+      r = filewrite(f, e->addr, e->n);
+    else
+      r = filepwrite(f, e->addr, e->n, e->off);
+    break;
+  case UR_FSYNC:
+    r = filesync(f);
+    break;
+  default:
+    r = -1;
+  }
+  fileclose(f);
+  return r;
+}
+
+// Carry out submissions until the submission ring empties
+// or the completion ring fills, or ring work is stopped.
+static void
+uringrun(struct tgroup *tg)
+{
+  struct proc *p = myproc();
+  struct uring *r = tg->uring;
+  struct usqe e;
+  struct ucqe *c;
+  uint head;
+
+  while(!p->killed && !tg->uringstop){
+    head = r->sqhead;
+    if(head == *(volatile uint*)&r->sqtail)
+      break;
+    if(r->cqtail - *(volatile uint*)&r->cqhead >= URING_NENT)
+      break;
+    __sync_synchronize();   // read the entry after sqtail
+    e = r->sq[head % URING_NENT];
+    r->sqhead = head + 1;
+
+    c = &r->cq[r->cqtail % URING_NENT];
+    c->res = uringop(&e);
+    c->data = e.data;
+    __sync_synchronize();   // write the entry before cqtail
+    acquire(&tg->lock);
+    r->cqtail++;
+    wakeup(&tg->uring);     // uringenter() may be waiting
+    release(&tg->lock);
+  }
+}
+
+// tg's ring work, run by a worker thread (work.c).
+static void
+uringwork(void *arg)
+{
+  struct tgroup *tg = arg;
+  struct proc *p = myproc();
+
+  // it may wait for the group's pipes (work.c).
+  if(systemwork())
+    panic("uringwork: system worker");
+
+  // act for tg. q->tg only changes with tg->lock held.
+  acquire(&tg->lock);
+  acquire(&p->lock);
+  p->tg = tg;
+  p->pagetable = tg->pagetable;
+  release(&p->lock);
+  tg->uringproc = p;
+  release(&tg->lock);
+
+  for(;;){
+    uringrun(tg);
+    acquire(&tg->lock);
+    // uringenter() found more submissions meanwhile?
+    if(!tg->uringmore || tg->uringstop || p->killed)
+      break;
+    tg->uringmore = 0;
+    release(&tg->lock);
+  }
+
+  // still holding tg->lock. exit() may have killed p
+  // while it acted for tg; that was meant for tg.
+  acquire(&p->lock);
+  p->tg = 0;
+  p->pagetable = 0;
+  p->killed = 0;
+  release(&p->lock);
+  tg->uringproc = 0;
+  tg->uringbusy = 0;
+  tg->uringmore = 0;
+  wakeup(tg);               // uringstop() may be waiting
+  wakeup(&tg->uring);       // and uringenter()
+  release(&tg->lock);
+}
+
+// Hand the queued submissions to a worker, and wait until
+// at least min completions are ready, or the worker is done.
+// Returns how many completions are ready.
+int
+uringenter(int min)
+{
+  struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
+  struct uring *r;
+  int n;
+
+  if((r = tg->uring) == 0 || min < 0 || min > URING_NENT)
+    return -1;
+  acquire(&tg->lock);
+  if(r->sqhead != *(volatile uint*)&r->sqtail){
+    if(tg->uringbusy){
+      tg->uringmore = 1;
+    } else {
+      tg->uringbusy = 1;
+      queue_work(tg->uringwork);
+    }
+  }
+  while((n = r->cqtail - *(volatile uint*)&r->cqhead) < min &&
+        tg->uringbusy && !p->killed)
+    sleep(&tg->uring, &tg->lock);
+  release(&tg->lock);
+  return n;
+}
+
+// Stop tg's ring work, and wait until the worker is done
+// with tg, for exit() and exec(), which are about to take
+// its files or memory away. Caller holds tg->lock.
+void
+uringstop(struct tgroup *tg)
+{
+  struct proc *q;
+
+  tg->uringstop = 1;
+  if((q = tg->uringproc) != 0){
+    // as in exit(): don't let it wait for a pipe forever.
+    acquire(&q->lock);
+    q->killed = 1;
+    if(q->state == SLEEPING)
+      q->state = RUNNABLE;
+    release(&q->lock);
+  }
+  while(tg->uringbusy)
+    sleep(tg, &tg->lock);
+  tg->uringstop = 0;
+}
@@ -0,0 +1,38 @@
+// Submission and completion rings, shared between a process
+// and the kernel in the page uring_setup() maps at URING.
+// The process fills in submissions and advances sqtail,
+// then calls uring_enter(); a kernel worker carries them
+// out, advancing sqhead, and posts a completion for each
+// as it finishes, advancing cqtail. The process consumes
+// completions and advances cqhead.
+
+#define URING_NENT 64     // entries in each ring
+
+// submission operations
+#define UR_NOP    0
+#define UR_READ   1
+#define UR_WRITE  2
+#define UR_FSYNC  3
+#define UR_OPEN   4
+
+struct usqe {
+  int op;         // UR_
+  int fd;
+  uint64 addr;    // buffer, or path for UR_OPEN
+  int n;          // bytes, or O_ flags for UR_OPEN
+  int off;        // file offset, or -1 for the fd's own
+  uint64 data;    // returned in the completion
+};
+
+struct ucqe {
+  uint64 data;    // the submission's data
+  int res;        // what the system call would return
+  int pad;
+};
+
+struct uring {
+  uint sqhead, sqtail;
+  uint cqhead, cqtail;
+  struct usqe sq[URING_NENT];
+  struct ucqe cq[URING_NENT];
+};
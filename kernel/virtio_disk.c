@@ -121,6 +121,7 @@ virtio_disk_init(int n)
     disk[n].free[i] = 1;
 
   disk[n].init = 1;
+  bdevsw[n].rw = virtio_disk_rw;
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
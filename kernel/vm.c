@@ -3,6 +3,9 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -17,6 +20,23 @@ extern char trampoline[]; // trampoline.S
 
 void print(pagetable_t);
 
+// Address-space IDs. Each process's satp carries an ASID that
+// tags its TLB entries, so that switching page tables needn't
+// flush the TLB. The kernel's page table uses ASID 0.
+//
+// ASIDs are handed out in order and never reused within a
+// generation. When they run out, a new generation starts: each
+// process gets a new ASID the next time it returns to user space,
+// and each CPU flushes its whole TLB before it first uses an ASID
+// of the new generation.
+//
+// If satp has no ASID bits, asidmax is 0, every process runs with
+// ASID 0, and trampoline.S flushes the TLB on each switch.
+static struct spinlock asidlock;
+static uint64 asidmax;        // largest ASID satp holds
+static uint64 asidgen = 1;    // current generation
+static uint64 nextasid = 1;   // next free ASID in this generation
+
 /*
  * create a direct-map page table for the kernel and
  * turn on paging. called early, in supervisor mode.
@@ -25,6 +45,8 @@ void print(pagetable_t);
 void
 kvminit()
 {
+  initlock(&asidlock, "asid");
+
   kernel_pagetable = (pagetable_t) kalloc();
   memset(kernel_pagetable, 0, PGSIZE);
 
@@ -47,8 +69,15 @@ kvminit()
   kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses megapages from the first 2-megabyte
+  // boundary on.
   kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
+#ifdef RAMROOT
+  // the RAM disk, just past the RAM we use.
+  kvmmap(RAMDISK, RAMDISK, RAMDISKSIZE, PTE_R | PTE_W);
+#endif
+
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
@@ -59,13 +88,126 @@ kvminit()
 void
 kvminithart()
 {
+  // find out how many ASID bits satp implements, by
+  // writing all ones and reading back.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID_MASK);
+  if(cpuid() == 0)
+    asidmax = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
 
+// Return the satp value to run p with, giving p's process a
+// new ASID if its old one is from an earlier generation. The
+// threads of a process share its ASID. Called on the way to
+// user space, with interrupts off.
+uint64
+uvmsatp(struct proc *p)
+{
+  struct tgroup *tg = p->tg;
+  struct cpu *c = mycpu();
+  int id = cpuid();
+
+  if(asidmax == 0)
+    return MAKE_SATP(p->pagetable);
+
+  if(tg->asidgen != asidgen || c->asidgen != asidgen){
+    acquire(&asidlock);
+    if(tg->asidgen != asidgen){
+      if(nextasid > asidmax){
+        asidgen++;
+        nextasid = 1;
+      }
+      tg->asid = nextasid++;
+      tg->tlbcpus = 0;
+      tg->tlbstale = 0;
+      __sync_synchronize();
+      tg->asidgen = asidgen;
+    }
+    if(c->asidgen != asidgen){
+      sfence_vma();
+      c->asidgen = asidgen;
+    }
+    release(&asidlock);
+  }
+
+  // other CPUs, running other threads, update these too.
+  if(tg->tlbstale & (1 << id)){
+    sfence_vma_asid(tg->asid);
+    __sync_fetch_and_and(&tg->tlbstale, ~(1 << id));
+  }
+  __sync_fetch_and_or(&tg->tlbcpus, 1 << id);
+  return MAKE_SATP(p->pagetable) | (tg->asid << SATP_ASID_SHIFT);
+}
+
+// Flush p's TLB entries for user addresses [va, va+size) after
+// their PTEs have been removed or changed: on this CPU now, and
+// on any other CPU p's process has run on when one of its
+// threads next runs there. Threads running on other CPUs at the
+// moment may still use old entries; see uvmshootdown().
+void
+uvmflush(struct proc *p, uint64 va, uint64 size)
+{
+  struct tgroup *tg = p->tg;
+  uint64 a;
+  int id;
+
+  if(asidmax == 0 || tg->asidgen == 0)
+    return;    // trampoline.S flushes, or p has no TLB entries.
+
+  push_off();
+  id = cpuid();
+  if(tg->tlbcpus & (1 << id)){
+    if(size > 64*PGSIZE){
+      sfence_vma_asid(tg->asid);
+    } else {
+      for(a = PGROUNDDOWN(va); a < va + size; a += PGSIZE)
+        sfence_vma_page(a, tg->asid);
+    }
+  }
+  __sync_fetch_and_or(&tg->tlbstale, tg->tlbcpus & ~(1 << id));
+  pop_off();
+}
+
+// Make the other CPUs that are running threads of p's process
+// flush their TLBs, and wait until they have. Caller holds no
+// spinlocks: the other CPUs may be waiting for one with
+// interrupts off, and this CPU must take their interrupts.
+void
+uvmshootdown(struct proc *p)
+{
+  uint cpumask;
+  struct proc *q;
+  int i, id;
+
+  cpumask = 0;
+  push_off();
+  id = cpuid();
+  for(i = 0; i < NCPU; i++){
+    q = cpus[i].proc;
+    if(i != id && q != 0 && q->tg == p->tg){
+      cpus[i].tlbflush = 1;
+      cpumask |= 1 << i;
+    }
+  }
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++)
+    if(cpumask & (1 << i))
+      ipi(i);
+  pop_off();
+
+  for(i = 0; i < NCPU; i++)
+    if(cpumask & (1 << i))
+      while(cpus[i].tlbflush)
+        ;
+}
+
 // Return the address of the PTE in page table pagetable
-// that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// that corresponds to virtual address va at *level: 0 for
+// a 4096-byte page, 1 for a 2-megabyte megapage. If alloc!=0,
+// create any required page-table pages. If a leaf PTE above
+// *level maps va, return that instead and set *level to its level.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -76,14 +218,18 @@ kvminithart()
 //   12..20 -- 9 bits of level-0 index.
 //    0..12 -- 12 bits of byte offset within the page.
 static pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -92,30 +238,236 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
-// Can only be used to look up user pages.
-uint64
-walkaddr(pagetable_t pagetable, uint64 va)
+// Return the address of the leaf PTE that maps va,
+// which may be a megapage's.
+static pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  pte_t *pte;
+  int level = 0;
+
+  return walklevel(pagetable, va, alloc, &level);
+}
+
+// The physical address of the page containing va,
+// given the leaf PTE that maps va at level.
+static uint64
+pte2pa(pte_t pte, int level, uint64 va)
+{
+  return PTE2PA(pte) + (PGROUNDDOWN(va) & ((1L << PXSHIFT(level)) - 1));
+}
+
+// Replace the megapage leaf *pte by a page-table page of 512
+// leaves that map the same memory with the same permissions.
+// After that, uvmunmap() frees the memory a page at a time.
+// Returns 0 on success, -1 if out of memory.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pagetable;
   uint64 pa;
+  int i;
 
-  if(va >= MAXVA)
-    return 0;
+  if((pagetable = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(i = 0; i < 512; i++)
+    pagetable[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(pagetable) | PTE_V;
+  return 0;
+}
 
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
+// Demand paging of programs: exec() maps no pages of the
+// program, but records its segments in tg->seg and keeps a
+// reference to the program's inode in tg->execip. The first
+// touch of a segment page, by the program (a page fault in
+// usertrap()) or by the kernel (copyin() and friends), reads
+// it through the buffer cache into a new page. Pages of
+// read-only segments come from textcache.c instead, shared
+// with other processes running the same program.
+
+// Return the physical address of user page va if pagetable
+// maps it with all of perm, else 0.
+static uint64
+walkperm(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+  int level = 0;
+
+  if(va >= MAXVA)
     return 0;
-  if((*pte & PTE_V) == 0)
+  pte = walklevel(pagetable, va, 0, &level);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|perm)) != (PTE_V|PTE_U|perm))
     return 0;
-  if((*pte & PTE_U) == 0)
+  return pte2pa(*pte, level, va);
+}
+
+// A fault on page a, which is mapped: this CPU's TLB may still
+// hold the miss from before another thread or CPU mapped it,
+// and with an ASID trampoline.S doesn't flush it. Flush that
+// entry, so that the retried access walks the page table.
+static void
+uvmrefresh(struct proc *p, uint64 a)
+{
+  struct tgroup *tg = p->tg;
+
+  if(asidmax != 0 && tg->asidgen == asidgen)
+    sfence_vma_page(a, tg->asid);
+}
+
+// Make sure p maps the page containing va with all of perm,
+// mapping it first if it is in one of p's segments and not
+// mapped yet. Reading the page in may sleep.
+// Returns 0 on success, -1 if va isn't mapped with perm or
+// the page can't be read.
+int
+uvmfault(struct proc *p, uint64 va, int perm)
+{
+  struct tgroup *tg = p->tg;
+  struct seg *s;
+  uint64 a, n, pa;
+  char *mem;
+
+  a = PGROUNDDOWN(va);
+  if(walkaddr(tg->pagetable, a) != 0){
+    uvmrefresh(p, a);
+    return walkperm(tg->pagetable, a, perm) ? 0 : -1;
+  }
+
+  // another thread may be faulting in the same page,
+  // or changing the process's size.
+  acquiresleep(&tg->vmlock);
+  if(walkaddr(tg->pagetable, a) != 0){
+    uvmrefresh(p, a);
+    goto out;
+  }
+  if(a >= tg->sz)
+    goto out;
+  for(s = tg->seg; s < tg->seg + tg->nseg; s++)
+    if(a >= s->va && a < s->end)
+      break;
+  if(s == tg->seg + tg->nseg)
+    goto out;
+
+  n = 0;
+  if(a < s->fileend){
+    n = s->fileend - a;
+    if(n > PGSIZE)
+      n = PGSIZE;
+  }
+  if((s->perm & PTE_W) == 0 &&
+     (pa = textget(tg->execip, s->off + (a - s->va), n)) != 0){
+    if(mappages(tg->pagetable, a, PGSIZE, pa, s->perm|PTE_U|PTE_TEXT) != 0){
+      textput(pa);
+      goto out;
+    }
+  } else {
+    if((mem = n > 0 ? kalloc() : kzalloc()) == 0)
+      goto out;
+    if(n > 0){
+      ilock(tg->execip);
+      if(readi(tg->execip, 0, (uint64)mem, s->off + (a - s->va), n) != n){
+        iunlock(tg->execip);
+        kfree(mem);
+        goto out;
+      }
+      iunlock(tg->execip);
+      memset(mem + n, 0, PGSIZE - n);
+    }
+    if(mappages(tg->pagetable, a, PGSIZE, (uint64)mem, s->perm|PTE_U) != 0){
+      kfree(mem);
+      goto out;
+    }
+  }
+  // the PTE was invalid; don't let a cached miss linger.
+  uvmflush(p, a, PGSIZE);
+
+out:
+  releasesleep(&tg->vmlock);
+  return walkperm(tg->pagetable, a, perm) ? 0 : -1;
+}
+
+// Fault in the pages of p's segments in [va, va+len), for
+// callers that will copy to or from them with locks held.
+void
+uvmprefault(struct proc *p, uint64 va, uint64 len)
+{
+  struct seg *s;
+  uint64 a, end;
+
+  end = va + len;
+  if(end < va)
+    end = MAXVA;
+  for(s = p->tg->seg; s < p->tg->seg + p->tg->nseg; s++){
+    for(a = PGROUNDDOWN(va > s->va ? va : s->va); a < end && a < s->end; a += PGSIZE)
+      if(uvmfault(p, a, 0) < 0)
+        return;
+  }
+}
+
+// The physical address of user page va, for copyin() and
+// friends (perm PTE_R) and copyout() (PTE_W), or 0 if it
+// isn't mapped with perm. Faults the page in first if
+// pagetable is the current process's and the caller holds
+// no spinlocks (uvmfault() may sleep).
+// If pagetable is the current thread group's, other threads
+// may shrink it with growproc(), so a page found here stays
+// counted in tg->ncopy, and so isn't freed, until uvmput(*tgp).
+uint64
+uvmget(pagetable_t pagetable, uint64 va, int perm, struct tgroup **tgp)
+{
+  struct proc *p = myproc();
+  struct tgroup *tg;
+  uint64 pa;
+  int locked;
+
+  *tgp = 0;
+  if(p == 0 || p->tg == 0 || p->pagetable != pagetable)
+    return walkperm(pagetable, va, perm);
+  tg = p->tg;
+
+  // count the copy before looking at the PTE: growproc()
+  // clears PTE_V before it waits for tg->ncopy to drain.
+  __atomic_fetch_add(&tg->ncopy, 1, __ATOMIC_SEQ_CST);
+  if((pa = walkperm(pagetable, va, perm)) != 0){
+    *tgp = tg;
+    return pa;
+  }
+  __atomic_fetch_sub(&tg->ncopy, 1, __ATOMIC_SEQ_CST);
+
+  // uvmfault() takes tg->vmlock, which growproc() holds
+  // while it waits, so fault without the count.
+  push_off();
+  locked = mycpu()->noff > 1;
+  pop_off();
+  if(locked || uvmfault(p, va, perm) < 0)
     return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  __atomic_fetch_add(&tg->ncopy, 1, __ATOMIC_SEQ_CST);
+  if((pa = walkperm(pagetable, va, perm)) != 0){
+    *tgp = tg;
+    return pa;
+  }
+  __atomic_fetch_sub(&tg->ncopy, 1, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+// Done with the page uvmget() returned.
+void
+uvmput(struct tgroup *tg)
+{
+  if(tg)
+    __atomic_fetch_sub(&tg->ncopy, 1, __ATOMIC_SEQ_CST);
+}
+
+// Look up a virtual address, return the physical address,
+// or 0 if not mapped.
+// Can only be used to look up user pages.
+uint64
+walkaddr(pagetable_t pagetable, uint64 va)
+{
+  return walkperm(pagetable, va, 0);
 }
 
 // add a mapping to the kernel page table.
@@ -138,30 +490,52 @@ kvmpa(uint64 va)
   uint64 off = va % PGSIZE;
   pte_t *pte;
   uint64 pa;
+  int level = 0;
   
-  pte = walk(kernel_pagetable, va, 0);
+  pte = walklevel(kernel_pagetable, va, 0, &level);
   if(pte == 0)
     panic("kvmpa");
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
-  pa = PTE2PA(*pte);
+  pa = pte2pa(*pte, level, va);
   return pa+off;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Where va and pa are both megapage-aligned and
+// at least a megapage remains, uses a single megapage PTE, unless
+// there already is a page-table page for that range.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
+  int level;
 
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    level = 0;
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && last - a >= SUPERPGSIZE - PGSIZE){
+      level = 1;
+      if((pte = walklevel(pagetable, a, 1, &level)) == 0)
+        return -1;
+      if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+        if(*pte & PTE_V)
+          panic("remap");
+        *pte = PA2PTE(pa) | perm | PTE_V;
+        if(last - a == SUPERPGSIZE - PGSIZE)
+          break;
+        a += SUPERPGSIZE;
+        pa += SUPERPGSIZE;
+        continue;
+      }
+      level = 0;
+    }
+    if((pte = walklevel(pagetable, a, 1, &level)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("remap");
@@ -174,30 +548,52 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
-// Remove mappings from a page table. The mappings in
-// the given range must exist. Optionally free the
-// physical memory.
+// Remove mappings from a page table. Pages in the range
+// that were never mapped (demand-paged program pages that
+// weren't touched) are skipped, but pages uvmrevoke() took
+// away are not. Optionally free the physical memory. A
+// megapage that is only partly in the range is first
+// demoted to 4096-byte pages.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
 {
   uint64 a, last;
   pte_t *pte;
   uint64 pa;
+  int level;
 
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0){
-      printf("va=%p pte=%p\n", a, *pte);
-      panic("uvmunmap: not mapped");
+    level = 0;
+    if((pte = walklevel(pagetable, a, 0, &level)) == 0 || *pte == 0){
+      if(a == last)
+        break;
+      a += PGSIZE;
+      continue;
     }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(level == 1){
+      if(a % SUPERPGSIZE != 0 || last - a < SUPERPGSIZE - PGSIZE){
+        if(demote(pte) != 0)
+          panic("uvmunmap: demote");
+        continue;
+      }
+      if(do_free)
+        kfree_super((void*)PTE2PA(*pte));
+      *pte = 0;
+      if(last - a == SUPERPGSIZE - PGSIZE)
+        break;
+      a += SUPERPGSIZE;
+      continue;
+    }
     if(do_free){
       pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      if(*pte & PTE_TEXT)
+        textput(pa);
+      else
+        kfree((void*)pa);
     }
     *pte = 0;
     if(a == last)
@@ -207,6 +603,33 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
   }
 }
 
+// Make the user pages in [va, va+size) inaccessible, without
+// forgetting them: clear PTE_V but leave the rest of the PTE
+// for uvmunmap() to free. Demotes megapages, so that the pages
+// are all at level 0. For shrinking memory that other threads
+// may be using: after this, uvmshootdown() makes sure that no
+// CPU still has the pages in its TLB before they are freed.
+void
+uvmrevoke(pagetable_t pagetable, uint64 va, uint64 size)
+{
+  uint64 a;
+  pte_t *pte;
+  int level;
+
+  for(a = PGROUNDUP(va); a < va + size; a += PGSIZE){
+    level = 0;
+    if((pte = walklevel(pagetable, a, 0, &level)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if(level == 1){
+      if(demote(pte) != 0)
+        panic("uvmrevoke: demote");
+      level = 0;
+      pte = walklevel(pagetable, a, 0, &level);
+    }
+    *pte &= ~PTE_V;
+  }
+}
+
 // create an empty user page table.
 pagetable_t
 uvmcreate()
@@ -249,12 +672,22 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   oldsz = PGROUNDUP(oldsz);
   a = oldsz;
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    // use a megapage for each aligned 2 megabytes, if there is one.
+    if(a % SUPERPGSIZE == 0 && newsz - a >= SUPERPGSIZE && (mem = kalloc_super()) != 0){
+      memset(mem, 0, SUPERPGSIZE);
+      if(mappages(pagetable, a, SUPERPGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+        kfree_super(mem);
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -311,7 +744,7 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 }
 
 // Given a parent process's page table, copy
-// its memory into a child's page table.
+// its mapped memory into a child's page table.
 // Copies both the page table and the
 // physical memory.
 // returns 0 on success, -1 on failure.
@@ -323,14 +756,33 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   uint64 pa, i;
   uint flags;
   char *mem;
+  int level;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
+    level = 0;
+    if((pte = walklevel(old, i, 0, &level)) == 0 || (*pte & PTE_V) == 0)
+      continue;   // not yet demand-paged; the child will fault it in.
     flags = PTE_FLAGS(*pte);
+    if(level == 1 && i % SUPERPGSIZE == 0 && (mem = kalloc_super()) != 0){
+      memmove(mem, (char*)PTE2PA(*pte), SUPERPGSIZE);
+      if(mappages(new, i, SUPERPGSIZE, (uint64)mem, flags) != 0){
+        kfree_super(mem);
+        goto err;
+      }
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    // share cached program text.
+    if(flags & PTE_TEXT){
+      pa = PTE2PA(*pte);
+      if(mappages(new, i, PGSIZE, pa, flags) != 0)
+        goto err;
+      textdup(pa);
+      continue;
+    }
+    // copy a page at a time, even out of a megapage,
+    // if there is no free megapage.
+    pa = pte2pa(*pte, level, i);
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -352,10 +804,17 @@ void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
+  int level = 0;
   
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, &level);
   if(pte == 0)
     panic("uvmclear");
+  if(level == 1){
+    // don't take the whole megapage away from the user.
+    if(demote(pte) != 0)
+      panic("uvmclear: demote");
+    pte = walk(pagetable, va, 0);
+  }
   *pte &= ~PTE_U;
 }
 
@@ -366,16 +825,18 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct tgroup *tg;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmget(pagetable, va0, PTE_W, &tg);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    uvmput(tg);
 
     len -= n;
     src += n;
@@ -391,16 +852,18 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct tgroup *tg;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmget(pagetable, va0, PTE_R, &tg);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    uvmput(tg);
 
     len -= n;
     dst += n;
@@ -418,10 +881,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  struct tgroup *tg;
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmget(pagetable, va0, PTE_R, &tg);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -442,6 +906,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    uvmput(tg);
 
     srcva = va0 + PGSIZE;
   }
@@ -0,0 +1,165 @@
+// Work queues: code that can't sleep, such as an interrupt
+// handler, or that shouldn't wait, such as a page fault,
+// queues a struct work (work.h) for a kernel thread to run.
+//
+// Each CPU has a queue and a worker thread (kthread_create())
+// that runs only on that CPU, in each of NWQ pools. queue_work()
+// puts work on the queue of the CPU it's called on, in the
+// work's pool, so the work usually runs soon after, with the
+// caller's data still in that CPU's cache.
+// Work may sleep, but holds up the rest of its queue meanwhile.
+// So work that acts for a process, such as a ring's (uring.c),
+// goes in WQ_USER, apart from the kernel's WQ_SYSTEM work.
+//
+// WQ_SYSTEM work must not wait for anything a process controls
+// (a pipe, the console, a futex, another process): it may wait
+// only for the disk and kernel locks, or the log flusher and
+// kzalloc()'s zeroing could wait forever. Processes' pipes and
+// files are reached through p->tg, so work that takes on a
+// thread group checks that it isn't in one (systemwork()).
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "work.h"
+#include "defs.h"
+
+struct workq {
+  struct spinlock lock;
+  struct work *head;
+  struct work *tail;
+} workq[NWQ][NCPU];
+
+static volatile uint workcpus;  // CPUs whose workers have started
+
+void
+workinit(void)
+{
+  int i, j;
+
+  for(i = 0; i < NWQ; i++)
+    for(j = 0; j < NCPU; j++)
+      initlock(&workq[i][j].lock, "workq");
+}
+
+void
+initwork(struct work *w, int pool, void (*fn)(void*), void *arg)
+{
+  w->fn = fn;
+  w->arg = arg;
+  w->pool = pool;
+  w->queued = 0;
+  w->next = 0;
+}
+
+// Queue w on CPU cpu's queue in w's pool, unless it's
+// already queued. cpu must have called workstart().
+// Can be called from interrupt handlers.
+// Returns 1 if w was queued, 0 if it already was.
+int
+queue_work_on(int cpu, struct work *w)
+{
+  struct workq *q;
+
+  if(__sync_lock_test_and_set(&w->queued, 1))
+    return 0;
+  q = &workq[w->pool][cpu];
+  acquire(&q->lock);
+  w->next = 0;
+  if(q->tail)
+    q->tail->next = w;
+  else
+    q->head = w;
+  q->tail = w;
+  wakeup(q);
+  release(&q->lock);
+  return 1;
+}
+
+// Queue w on this CPU's queue, as queue_work_on().
+int
+queue_work(struct work *w)
+{
+  int r;
+
+  push_off();
+  r = queue_work_on(cpuid(), w);
+  pop_off();
+  return r;
+}
+
+// The n'th CPU, modulo the number that have started their
+// workers, for spreading periodic work over the CPUs.
+int
+workcpu(uint n)
+{
+  uint mask = workcpus;
+  int cpu, ncpu = 0;
+
+  for(cpu = 0; cpu < NCPU; cpu++)
+    if(mask & (1 << cpu))
+      ncpu++;
+  if(ncpu == 0)
+    return 0;
+  n %= ncpu;
+  for(cpu = 0; cpu < NCPU; cpu++)
+    if((mask & (1 << cpu)) && n-- == 0)
+      break;
+  return cpu;
+}
+
+static void
+worker(void *arg)
+{
+  struct workq *q = arg;
+  struct proc *p = myproc();
+  struct work *w;
+
+  // from now on, run only on q's CPU.
+  acquire(&p->lock);
+  p->cpu = (q - &workq[0][0]) % NCPU;
+  release(&p->lock);
+  yield();
+
+  for(;;){
+    acquire(&q->lock);
+    while((w = q->head) == 0)
+      sleep(q, &q->lock);
+    if((q->head = w->next) == 0)
+      q->tail = 0;
+    release(&q->lock);
+    __sync_lock_release(&w->queued);
+    w->fn(w->arg);
+  }
+}
+
+// Is the current thread a WQ_SYSTEM worker?
+int
+systemwork(void)
+{
+  struct proc *p = myproc();
+
+  return p->kfn == worker && (struct workq*)p->karg < workq[WQ_USER];
+}
+
+// Start this CPU's worker threads.
+void
+workstart(void)
+{
+  static char *names[NWQ] = { "kworker0", "uworker0" };
+  char name[16];
+  int id = cpuid();
+  int i;
+
+  for(i = 0; i < NWQ; i++){
+    safestrcpy(name, names[i], sizeof(name));
+    name[7] += id;
+    if(kthread_create(worker, &workq[i][id], name) < 0)
+      panic("workstart");
+  }
+  __sync_fetch_and_or(&workcpus, 1 << id);
+}
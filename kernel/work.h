@@ -0,0 +1,17 @@
+// Worker pools (work.c). Work that acts for a process, and
+// so may wait for the process's pipes or console, goes to
+// WQ_USER, where it can't hold up the kernel's own work.
+#define WQ_SYSTEM 0
+#define WQ_USER   1
+#define NWQ       2
+
+// A piece of deferred work (work.c): fn(arg), to be run
+// later by a kernel worker thread. Queued at most once
+// at a time; it can be queued again once it starts.
+struct work {
+  void (*fn)(void*);
+  void *arg;
+  int pool;               // WQ_SYSTEM or WQ_USER
+  int queued;             // on a queue, or about to be
+  struct work *next;      // on its workq
+};
@@ -0,0 +1,48 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Measure bd_malloc()/bd_free() throughput in the kernel's
+// buddy allocator, for a range of block sizes, first from one
+// process and then from NCHILD processes at once.
+
+#define N      200000
+#define NCHILD 3
+
+void
+run(int nbytes, int nproc)
+{
+  int i, pid, t0, t1, status, fail;
+
+  fail = 0;
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("bdbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(bdbench(nbytes, N) == N ? 0 : 1);
+  }
+  for(i = 0; i < nproc; i++){
+    wait(&status);
+    if(status != 0)
+      fail = 1;
+  }
+  t1 = uptime();
+  printf("%d procs, %d bytes: %d allocs in %d ticks%s\n", nproc, nbytes,
+         nproc*N, t1 - t0, fail ? " (some failed)" : "");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nbytes;
+
+  for(nbytes = 16; nbytes <= 4096; nbytes *= 2)
+    run(nbytes, 1);
+  for(nbytes = 16; nbytes <= 4096; nbytes *= 2)
+    run(nbytes, NCHILD);
+  exit(0);
+}
@@ -0,0 +1,49 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Copy a file with copy_file_range(), which moves the
+// data inside the kernel; fall back to read() and write()
+// if the source isn't a plain file (a directory or device,
+// which copy_file_range() refuses).
+
+char buf[512];
+
+int
+main(int argc, char *argv[])
+{
+  int in, out, n;
+
+  if(argc != 3){
+    fprintf(2, "Usage: cp from to\n");
+    exit(1);
+  }
+  if((in = open(argv[1], O_RDONLY)) < 0){
+    fprintf(2, "cp: cannot open %s\n", argv[1]);
+    exit(1);
+  }
+  // there's no O_TRUNC: replace the old file.
+  unlink(argv[2]);
+  if((out = open(argv[2], O_CREATE|O_WRONLY)) < 0){
+    fprintf(2, "cp: cannot create %s\n", argv[2]);
+    exit(1);
+  }
+  while((n = copy_file_range(in, out, 64*1024)) > 0)
+    ;
+  if(n < 0){
+    while((n = read(in, buf, sizeof(buf))) > 0){
+      if(write(out, buf, n) != n){
+        fprintf(2, "cp: write error\n");
+        exit(1);
+      }
+    }
+  }
+  if(n < 0){
+    fprintf(2, "cp: read error\n");
+    exit(1);
+  }
+  close(in);
+  close(out);
+  exit(0);
+}
@@ -0,0 +1,39 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/klog.h"
+#include "user/user.h"
+
+// Print the kernel log, oldest record first.
+// dmesg -N prints only records at severity N
+// (e.g. 4 for warnings) or more severe.
+
+int
+main(int argc, char *argv[])
+{
+  struct klogrec *recs, *r;
+  int n, level, i;
+  char frac[7];
+  uint64 us;
+
+  level = KLOG_DEBUG;
+  if(argc > 1 && argv[1][0] == '-')
+    level = atoi(argv[1] + 1);
+
+  recs = malloc(NCPU * NKLOG * sizeof(*recs));
+  if(recs == 0 || (n = dmesg(recs, NCPU * NKLOG)) < 0){
+    fprintf(2, "dmesg: failed\n");
+    exit(1);
+  }
+  for(r = recs; r < recs + n; r++){
+    if(r->level > level)
+      continue;
+    us = r->usec % 1000000;
+    for(i = 5; i >= 0; i--, us /= 10)
+      frac[i] = '0' + us % 10;
+    frac[6] = 0;
+    printf("[%d.%s] <%d> cpu%d: %s\n", (int)(r->usec / 1000000), frac,
+           r->level, r->cpu, r->msg);
+  }
+  exit(0);
+}
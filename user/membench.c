@@ -0,0 +1,140 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Compare byte-at-a-time, word-at-a-time, and unrolled word
+// (ulib's, from kernel/memops.h) memset, memmove and memcmp,
+// for sizes from 16 bytes to 4 KB. Each test moves TOTAL bytes;
+// times are in clock ticks.
+
+#define TOTAL (32*1024*1024)
+#define MAXN  4096
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+static uint64 src[MAXN/8], dst[MAXN/8];
+
+static void
+byteset(void *d, int c, uint n)
+{
+  volatile char *p = d;
+
+  while(n-- > 0)
+    *p++ = c;
+}
+
+static void
+bytemove(void *d, const void *s, uint n)
+{
+  volatile char *p = d;
+  const char *q = s;
+
+  while(n-- > 0)
+    *p++ = *q++;
+}
+
+static int
+bytecmp(const void *s1, const void *s2, uint n)
+{
+  const volatile uchar *p = s1, *q = s2;
+
+  for(; n > 0; n--, p++, q++)
+    if(*p != *q)
+      return *p - *q;
+  return 0;
+}
+
+// word loops without unrolling; n is a multiple of 8
+// and the buffers are aligned.
+static void
+wordset(void *d, int c, uint n)
+{
+  volatile uint64 *p = d;
+  uint64 w = (uchar)c * 0x0101010101010101UL;
+
+  for(; n >= 8; n -= 8)
+    *p++ = w;
+}
+
+static void
+wordmove(void *d, const void *s, uint n)
+{
+  volatile uint64 *p = d;
+  const uint64 *q = s;
+
+  for(; n >= 8; n -= 8)
+    *p++ = *q++;
+}
+
+static int
+wordcmp(const void *s1, const void *s2, uint n)
+{
+  const volatile uint64 *p = s1, *q = s2;
+
+  for(; n >= 8; n -= 8, p++, q++)
+    if(*p != *q)
+      return bytecmp((void*)p, (void*)q, 8);
+  return 0;
+}
+
+static void
+libset(void *d, int c, uint n)
+{
+  memset(d, c, n);
+}
+
+static void
+libmove(void *d, const void *s, uint n)
+{
+  memmove(d, s, n);
+}
+
+static int
+libcmp(const void *s1, const void *s2, uint n)
+{
+  return memcmp(s1, s2, n);
+}
+
+struct variant {
+  char *name;
+  void (*set)(void*, int, uint);
+  void (*move)(void*, const void*, uint);
+  int (*cmp)(const void*, const void*, uint);
+} variants[] = {
+  { "byte",     byteset, bytemove, bytecmp },
+  { "word",     wordset, wordmove, wordcmp },
+  { "unrolled", libset,  libmove,  libcmp },
+};
+
+int
+main(int argc, char *argv[])
+{
+  struct variant *v;
+  int n, i, iters, t0, tset, tmove, tcmp;
+
+  printf("size    variant   memset memmove memcmp (ticks per %d MB)\n", TOTAL >> 20);
+  for(n = 16; n <= MAXN; n *= 4){
+    iters = TOTAL / n;
+    for(v = variants; v < variants + NELEM(variants); v++){
+      t0 = uptime();
+      for(i = 0; i < iters; i++)
+        v->set(dst, i, n);
+      tset = uptime() - t0;
+
+      t0 = uptime();
+      for(i = 0; i < iters; i++)
+        v->move(dst, src, n);
+      tmove = uptime() - t0;
+
+      t0 = uptime();
+      for(i = 0; i < iters; i++)
+        if(v->cmp(dst, src, n) != 0){
+          printf("membench: %s memcmp wrong at size %d\n", v->name, n);
+          exit(1);
+        }
+      tcmp = uptime() - t0;
+
+      printf("%d\t%s\t%d\t%d\t%d\n", n, v->name, tset, tmove, tcmp);
+    }
+  }
+  exit(0);
+}
@@ -2,6 +2,7 @@
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
 #include "user/user.h"
+#include "kernel/memops.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -35,11 +36,7 @@ strlen(const char *s)
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
+  memops_set(dst, c, n);
   return dst;
 }
 
@@ -98,35 +95,15 @@ atoi(const char *s)
 void*
 memmove(void *vdst, const void *vsrc, int n)
 {
-  char *dst;
-  const char *src;
-
-  dst = vdst;
-  src = vsrc;
-  if (src > dst) {
-    while(n-- > 0)
-      *dst++ = *src++;
-  } else {
-    dst += n;
-    src += n;
-    while(n-- > 0)
-      *--dst = *--src;
-  }
+  if(n > 0)
+    memops_move(vdst, vsrc, n);
   return vdst;
 }
 
 int
 memcmp(const void *s1, const void *s2, uint n)
 {
-  const char *p1 = s1, *p2 = s2;
-  while (n-- > 0) {
-    if (*p1 != *p2) {
-      return *p1 - *p2;
-    }
-    p1++;
-    p2++;
-  }
-  return 0;
+  return memops_cmp(s1, s2, n);
 }
 
 void *
@@ -134,3 +111,30 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static void
+tstart(void *a)
+{
+  struct tstart *t = a;
+
+  t->fn(t->arg);
+  texit(0);
+}
+
+// Start a thread that runs fn(arg) on the size-byte stack
+// at stack, and exits when fn returns. Returns its ID.
+int
+thread_start(void (*fn)(void*), void *arg, void *stack, uint size)
+{
+  struct tstart *t;
+
+  t = (struct tstart*)(((uint64)stack + size - sizeof(*t)) & ~15L);
+  t->fn = fn;
+  t->arg = arg;
+  return clone(tstart, t, t);
+}
@@ -2,89 +2,276 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Size-class slab allocator.
+//
+// Requests of up to MAXSMALL bytes are rounded up to a power-of-two
+// size class and carved out of slabs. A slab is one page: a struct
+// slab header at the start of the page, followed by equal-sized
+// objects. Each slab keeps its free objects on a list threaded
+// through the objects themselves, and each class keeps a list of the
+// slabs that still have free objects, so allocating or freeing a
+// small object touches only the head of two lists. free() finds the
+// header by rounding the pointer down to its page.
+//
+// Bigger requests get a run of whole pages, with the same header at
+// the start of the first page.
+//
+// Pages come from an address-ordered list of free page runs, which is
+// refilled from the kernel with sbrk() CHUNKPAGES at a time. Freed
+// runs are merged with their neighbours, and a free run at the top
+// of the heap is given back with a negative sbrk() once it grows to
+// TRIMPAGES.
 
-typedef long Align;
+#define MINSHIFT   4                    // smallest class is 16 bytes
+#define NCLASS     7                    // 16, 32, ..., 1024
+#define MAXSMALL   (1 << (MINSHIFT+NCLASS-1))
+#define LARGE      NCLASS               // class of a page-run allocation
+#define CHUNKPAGES 16                   // pages per sbrk() refill
+#define TRIMPAGES  32                   // give back top runs this big
+#define SLAB_MAGIC 0x51ab51ab
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+struct slab {
+  uint magic;          // SLAB_MAGIC
+  uint cls;            // size class, or LARGE
+  uint npages;         // pages in a LARGE run
+  uint nobj;           // objects in this slab
+  uint nfree;          // free objects in this slab
+  struct slab *next;   // class's list of slabs with free objects
+  struct slab *prev;
+  void *free;          // free objects, linked through their first word
 };
 
-typedef union header Header;
+// keep objects 16-byte aligned.
+#define HDRSIZE ((sizeof(struct slab) + 15) & ~15)
 
-static Header base;
-static Header *freep;
+struct run {
+  uint npages;
+  struct run *next;
+};
 
-void
-free(void *ap)
+static struct slab *partial[NCLASS];  // slabs with free objects
+static struct run *freeruns;          // free page runs, by address
+
+// Add the run of n pages at p to the free list,
+// merging it with its neighbours.
+static void
+insertrun(char *p, uint n)
+{
+  struct run *r, *prev, *next;
+
+  prev = 0;
+  for(next = freeruns; next && (char*)next < p; next = next->next)
+    prev = next;
+
+  r = (struct run*)p;
+  r->npages = n;
+  r->next = next;
+  if(next && p + (uint64)n*PGSIZE == (char*)next){
+    r->npages += next->npages;
+    r->next = next->next;
+  }
+  if(prev && (char*)prev + (uint64)prev->npages*PGSIZE == p){
+    prev->npages += r->npages;
+    prev->next = r->next;
+  } else if(prev){
+    prev->next = r;
+  } else {
+    freeruns = r;
+  }
+}
+
+// Give the topmost free run back to the kernel if it is
+// big enough and nothing has been sbrk()ed above it.
+static void
+trim(void)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  struct run *r, *prev;
+
+  if(freeruns == 0)
+    return;
+  prev = 0;
+  for(r = freeruns; r->next; r = r->next)
+    prev = r;
+  if(r->npages < TRIMPAGES)
+    return;
+  if((char*)r + (uint64)r->npages*PGSIZE != sbrk(0))
+    return;
+  if(prev)
+    prev->next = 0;
+  else
+    freeruns = 0;
+  sbrk(-(int)(r->npages*PGSIZE));
 }
 
-static Header*
-morecore(uint nu)
+// Ask the kernel for at least n more pages.
+static int
+morecore(uint n)
 {
+  uint64 top, pad;
+  uint want;
   char *p;
-  Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
+  if(n > (0x7fffffff - PGSIZE) / PGSIZE)
+    return -1;
+  want = n < CHUNKPAGES ? CHUNKPAGES : n;
+  top = (uint64)sbrk(0);
+  pad = PGROUNDUP(top) - top;   // someone else sbrk()ed an odd amount
+  p = sbrk(pad + want*PGSIZE);
+  if(p == (char*)-1 && want > n){
+    want = n;
+    p = sbrk(pad + want*PGSIZE);
+  }
   if(p == (char*)-1)
-    return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+    return -1;
+  insertrun(p + pad, want);
+  return 0;
 }
 
-void*
-malloc(uint nbytes)
+// Allocate a run of n pages, first fit.
+static void*
+pagealloc(uint n)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct run **pp, *r, *rest;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
+  for(;;){
+    for(pp = &freeruns; (r = *pp) != 0; pp = &r->next){
+      if(r->npages < n)
+        continue;
+      if(r->npages == n){
+        *pp = r->next;
+      } else {
+        rest = (struct run*)((char*)r + (uint64)n*PGSIZE);
+        rest->npages = r->npages - n;
+        rest->next = r->next;
+        *pp = rest;
       }
-      freep = prevp;
-      return (void*)(p + 1);
+      return r;
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+    if(morecore(n) < 0)
+      return 0;
   }
 }
+
+static void
+pagefree(void *p, uint n)
+{
+  insertrun(p, n);
+  trim();
+}
+
+static void
+slabunlink(struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    partial[s->cls] = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+slabpush(struct slab *s)
+{
+  s->prev = 0;
+  s->next = partial[s->cls];
+  if(s->next)
+    s->next->prev = s;
+  partial[s->cls] = s;
+}
+
+// Build a slab of class c, all objects free.
+static struct slab*
+newslab(int c)
+{
+  struct slab *s;
+  uint size, i;
+  char *o;
+
+  if((s = pagealloc(1)) == 0)
+    return 0;
+  size = 1 << (MINSHIFT + c);
+  s->magic = SLAB_MAGIC;
+  s->cls = c;
+  s->npages = 1;
+  s->nobj = (PGSIZE - HDRSIZE) / size;
+  s->nfree = s->nobj;
+  s->free = 0;
+  o = (char*)s + HDRSIZE + (s->nobj-1)*size;
+  for(i = 0; i < s->nobj; i++, o -= size){
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  slabpush(s);
+  return s;
+}
+
+static void*
+bigalloc(uint nbytes)
+{
+  struct slab *s;
+  uint64 n;
+
+  n = (HDRSIZE + (uint64)nbytes + PGSIZE - 1) / PGSIZE;
+  if(n > 0xffffffff || (s = pagealloc(n)) == 0)
+    return 0;
+  s->magic = SLAB_MAGIC;
+  s->cls = LARGE;
+  s->npages = n;
+  return (char*)s + HDRSIZE;
+}
+
+void
+free(void *ap)
+{
+  struct slab *s;
+
+  if(ap == 0)
+    return;
+  s = (struct slab*)PGROUNDDOWN((uint64)ap);
+  if(s->magic != SLAB_MAGIC){
+    fprintf(2, "free: bad pointer %p\n", ap);
+    exit(1);
+  }
+  if(s->cls == LARGE){
+    s->magic = 0;
+    pagefree(s, s->npages);
+    return;
+  }
+
+  *(void**)ap = s->free;
+  s->free = ap;
+  if(s->nfree++ == 0)
+    slabpush(s);
+  // keep one empty slab per class around, so that a class
+  // bouncing between 0 and 1 objects doesn't churn pages.
+  if(s->nfree == s->nobj && (s->prev || s->next)){
+    slabunlink(s);
+    s->magic = 0;
+    pagefree(s, 1);
+  }
+}
+
+void*
+malloc(uint nbytes)
+{
+  struct slab *s;
+  void *p;
+  int c;
+
+  if(nbytes > MAXSMALL)
+    return bigalloc(nbytes);
+
+  for(c = 0; (1 << (MINSHIFT + c)) < nbytes; c++)
+    ;
+  if((s = partial[c]) == 0 && (s = newslab(c)) == 0)
+    return 0;
+  p = s->free;
+  s->free = *(void**)p;
+  if(--s->nfree == 0)
+    slabunlink(s);
+  return p;
+}
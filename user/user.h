@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct klogrec;
+struct pollfd;
+struct iovec;
+struct uring;
 
 // system calls
 int fork(void);
@@ -10,7 +14,7 @@ int write(int, const void*, int);
 int read(int, void*, int);
 int close(int);
 int kill(int);
-int exec(char*, char**);
+int exec(char*, char**);  // kills the other threads; fails in any but the first
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -24,6 +28,28 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int ntas();
+int bdbench(int, int);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int tee(int, int, int);
+int dmesg(struct klogrec*, int);
+int clone(void (*)(void*), void*, void*);
+void texit(int) __attribute__((noreturn));
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int poll(struct pollfd*, int, int);
+int pipe2(int*, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int lseek(int, int, int);
+int copy_file_range(int, int, int);
+struct uring* uring_setup(void);
+int uring_enter(int);
+int fsync(int);
+int sync(void);
 int crash(const char*, int);
 int mount(char*, char *);
 int umount(char*);
@@ -44,3 +70,28 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int thread_start(void (*)(void*), void*, void*, uint);
+
+// usync.c
+struct mutex {
+  int state;    // 0 unlocked, 1 locked, 2 locked and maybe waited for
+};
+struct cond {
+  int seq;      // bumped by each signal
+  int nwait;    // threads in cond_wait()
+};
+struct sem {
+  int count;
+  int nwait;    // threads in sem_wait()
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void sem_init(struct sem*, int);
+void sem_wait(struct sem*);
+void sem_post(struct sem*);
@@ -4,9 +4,13 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/uio.h"
+#include "kernel/uring.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/klog.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -389,6 +393,563 @@ pipe1(char *s)
   }
 }
 
+// grow a pipe's buffer with fcntl() so that a write
+// fits without a reader, then shrink it while it holds data.
+void
+pipesize(char *s)
+{
+  int fds[2], i, n;
+  enum { N=6000 };
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != PGSIZE){
+    printf("%s: default pipe size not PGSIZE\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, N) != 2*PGSIZE){
+    printf("%s: F_SETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    buf[i] = i;
+  if(write(fds[1], buf, N) != N){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, PGSIZE) != -1){
+    printf("%s: shrank a pipe below its contents\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, N/2) != N/2 || fcntl(fds[1], F_SETPIPE_SZ, PGSIZE) != PGSIZE){
+    printf("%s: shrink failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  n = read(fds[0], buf, sizeof(buf));
+  if(n != N - N/2){
+    printf("%s: read %d bytes after shrink\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if((buf[i] & 0xff) != ((N/2 + i) & 0xff)){
+      printf("%s: wrong data after shrink\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  if(fcntl(0, F_SETPIPE_SZ, PGSIZE) != -1){
+    printf("%s: F_SETPIPE_SZ on a non-pipe\n", s);
+    exit(1);
+  }
+}
+
+// poll() two pipes, one of which a child writes to
+// after a while; then check timeouts and hang-ups.
+void
+polltest(char *s)
+{
+  int a[2], b[2], pid, xstatus;
+  struct pollfd fds[2];
+  char c;
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  if(poll(fds, 2, -1) != 1 || fds[0].revents != 0 || fds[1].revents != POLLIN){
+    printf("%s: poll didn't see the child's write\n", s);
+    exit(1);
+  }
+  if(read(b[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: read after poll failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+
+  if(poll(fds, 2, 0) != 0 || poll(fds, 2, 2) != 0){
+    printf("%s: poll of empty pipes didn't time out\n", s);
+    exit(1);
+  }
+  close(b[1]);
+  if(poll(fds, 2, -1) != 1 || (fds[1].revents & POLLHUP) == 0){
+    printf("%s: poll didn't see a closed pipe\n", s);
+    exit(1);
+  }
+  fds[0].fd = a[1];
+  fds[0].events = POLLOUT;
+  fds[1].fd = -1;
+  if(poll(fds, 2, 0) != 2 || fds[0].revents != POLLOUT || fds[1].revents != POLLNVAL){
+    printf("%s: poll of a pipe's write side failed\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+}
+
+// writev() segments bigger than a log transaction,
+// and readv() them back split differently.
+void
+writevtest(char *s)
+{
+  int fd, i;
+  char h[4];
+  struct iovec iov[3];
+  enum { N=8000 };
+
+  unlink("writev");
+  if((fd = open("writev", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    buf[i] = i * 7;
+  iov[0].base = "abc";
+  iov[0].len = 3;
+  iov[1].base = buf;
+  iov[1].len = N;
+  iov[2].base = "xyz";
+  iov[2].len = 3;
+  if(writev(fd, iov, 3) != N + 6){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  memset(buf, 0, N + 10);
+  fd = open("writev", O_RDONLY);
+  iov[0].base = h;
+  iov[0].len = 4;
+  iov[1].base = buf;
+  iov[1].len = N + 10;
+  if(readv(fd, iov, 2) != N + 6){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(memcmp(h, "abc", 3) != 0 || h[3] != 0 || memcmp(buf + N - 1, "xyz", 3) != 0){
+    printf("%s: readv read the wrong data\n", s);
+    exit(1);
+  }
+  for(i = 1; i < N; i++){
+    if(buf[i-1] != (char)(i * 7)){
+      printf("%s: wrong byte %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("writev");
+}
+
+// lseek() moves the offset; pread() and pwrite()
+// use their own offset and leave it alone.
+void
+preadtest(char *s)
+{
+  int fd, i;
+  char c[4];
+  enum { N=3000 };
+
+  unlink("pread");
+  if((fd = open("pread", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    buf[i] = i;
+  if(write(fd, buf, N) != N){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 0, SEEK_CUR) != N || lseek(fd, -N, SEEK_END) != 0 ||
+     lseek(fd, 1000, SEEK_SET) != 1000 || lseek(fd, 1, SEEK_END) != -1 ||
+     lseek(fd, -1001, SEEK_CUR) != -1){
+    printf("%s: lseek returned the wrong offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, c, 4, 2000) != 4 || c[0] != (char)2000 || c[3] != (char)2003){
+    printf("%s: pread failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "xyz", 3, 10) != 3 || pread(fd, c, 4, N - 2) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(read(fd, c, 1) != 1 || c[0] != (char)1000 || lseek(fd, 0, SEEK_CUR) != 1001){
+    printf("%s: pread or pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(lseek(fd, 9, SEEK_SET) != 9 || read(fd, c, 4) != 4 || memcmp(c, "\x09xyz", 4) != 0){
+    printf("%s: pwrite wrote the wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pread");
+}
+
+// copy_file_range() a file, in two pieces.
+void
+copytest(char *s)
+{
+  int fd, out, i;
+  enum { N=5000 };
+
+  unlink("copy1");
+  unlink("copy2");
+  fd = open("copy1", O_CREATE|O_RDWR);
+  out = open("copy2", O_CREATE|O_RDWR);
+  if(fd < 0 || out < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    buf[i] = i * 3;
+  if(write(fd, buf, N) != N || lseek(fd, 0, SEEK_SET) != 0){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(copy_file_range(fd, fd, N) != -1){
+    printf("%s: copied a file to itself\n", s);
+    exit(1);
+  }
+  if((i = open(".", O_RDONLY)) < 0 || copy_file_range(i, out, N) != -1){
+    printf("%s: copied a directory\n", s);
+    exit(1);
+  }
+  close(i);
+  if(copy_file_range(fd, out, 1000) != 1000 ||
+     copy_file_range(fd, out, N) != N - 1000 ||
+     copy_file_range(fd, out, N) != 0){
+    printf("%s: copy_file_range failed\n", s);
+    exit(1);
+  }
+  memset(buf, 0, N);
+  if(pread(out, buf, N + 1, 0) != N){
+    printf("%s: copy has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(buf[i] != (char)(i * 3)){
+      printf("%s: wrong byte %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  close(out);
+  unlink("copy1");
+  unlink("copy2");
+}
+
+// queue an open, writes, an fsync and reads on the
+// uring_setup() rings, and have a kernel worker carry
+// them out; each uring_enter() also waits for them.
+void
+uringtest(char *s)
+{
+  struct uring *r;
+  struct usqe *e;
+  struct ucqe *c;
+  char rbuf[2][8];
+  int i, fd;
+
+  unlink("uring");
+  if((r = uring_setup()) == (struct uring*)-1 || uring_setup() != r){
+    printf("%s: uring_setup failed\n", s);
+    exit(1);
+  }
+  e = &r->sq[r->sqtail % URING_NENT];
+  e->op = UR_OPEN;
+  e->addr = (uint64)"uring";
+  e->n = O_CREATE|O_RDWR;
+  e->data = 100;
+  r->sqtail++;
+  if(uring_enter(1) != 1 || r->cqtail != r->cqhead + 1){
+    printf("%s: uring_enter didn't open\n", s);
+    exit(1);
+  }
+  c = &r->cq[r->cqhead++ % URING_NENT];
+  if(c->data != 100 || (fd = c->res) < 0){
+    printf("%s: UR_OPEN failed\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < 5; i++){
+    e = &r->sq[r->sqtail++ % URING_NENT];
+    e->fd = fd;
+    e->data = i;
+    if(i < 2){
+      e->op = UR_WRITE;
+      e->addr = (uint64)(i == 0 ? "abcdefgh" : "ijklmnop");
+      e->n = 8;
+      e->off = -1;
+    } else if(i == 2){
+      e->op = UR_FSYNC;
+    } else {
+      e->op = UR_READ;
+      e->addr = (uint64)rbuf[i-3];
+      e->n = 8;
+      e->off = (4 - i) * 8;
+    }
+  }
+  if(uring_enter(5) != 5){
+    printf("%s: uring_enter didn't do 5\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 5; i++){
+    c = &r->cq[r->cqhead++ % URING_NENT];
+    if(c->data != i || c->res != (i == 2 ? 0 : 8)){
+      printf("%s: completion %d: data %d res %d\n", s, i, (int)c->data, c->res);
+      exit(1);
+    }
+  }
+  if(memcmp(rbuf[0], "ijklmnop", 8) != 0 || memcmp(rbuf[1], "abcdefgh", 8) != 0){
+    printf("%s: UR_READ read the wrong data\n", s);
+    exit(1);
+  }
+  if(uring_enter(1) != 0){
+    printf("%s: uring_enter of an empty ring\n", s);
+    exit(1);
+  }
+
+  // start some without waiting, and wait for them later.
+  for(i = 0; i < 3; i++){
+    e = &r->sq[r->sqtail++ % URING_NENT];
+    e->op = UR_NOP;
+    e->data = i;
+  }
+  if((i = uring_enter(0)) < 0 || i > 3 || uring_enter(3) != 3){
+    printf("%s: uring_enter didn't do 3 later\n", s);
+    exit(1);
+  }
+  r->cqhead += 3;
+  close(fd);
+  unlink("uring");
+}
+
+// the root disk's log's records start "log ROOTDEV: ".
+#define STR(x)   #x
+#define XSTR(x)  STR(x)
+#define ROOTLOG  "log " XSTR(ROOTDEV) ": "
+
+// the time of the newest kernel log record that starts
+// with prefix, or of the newest record if prefix is 0.
+static uint64
+klogtime(char *prefix)
+{
+  struct klogrec *recs, *r;
+  uint64 t;
+  int n;
+
+  recs = malloc(NCPU * NKLOG * sizeof(*recs));
+  if(recs == 0 || (n = dmesg(recs, NCPU * NKLOG)) < 0){
+    printf("dmesg failed\n");
+    exit(1);
+  }
+  t = 0;
+  for(r = recs; r < recs + n; r++)
+    if(r->usec > t && (prefix == 0 || memcmp(r->msg, prefix, strlen(prefix)) == 0))
+      t = r->usec;
+  free(recs);
+  return t;
+}
+
+// fsync() and sync() between many small writes, which
+// the log absorbs until a commit. The log's commits and
+// checkpoints show up in the kernel log.
+void
+synctest(char *s)
+{
+  int fd, i, p[2];
+  uint64 t;
+  char c;
+
+  unlink("sync");
+  if((fd = open("sync", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 200; i++){
+    c = i;
+    if(write(fd, &c, 1) != 1){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    t = klogtime(0);
+    if(i % 50 == 0 && fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+    if(i % 50 == 0 && klogtime(ROOTLOG "committed") <= t){
+      printf("%s: fsync didn't commit\n", s);
+      exit(1);
+    }
+  }
+  // sync() has something to write home, even if the
+  // last write() filled the log and emptied it.
+  t = klogtime(0);
+  if(pwrite(fd, &c, 1, 199) != 1 || sync() != 0){
+    printf("%s: sync failed\n", s);
+    exit(1);
+  }
+  if(klogtime(ROOTLOG "checkpoint") <= t){
+    printf("%s: sync didn't write the log home\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 200; i++){
+    if(pread(fd, &c, 1, i) != 1 || c != (char)i){
+      printf("%s: wrong byte %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(pipe(p) != 0 || fsync(p[0]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+  close(fd);
+  unlink("sync");
+}
+
+// reads and writes on an O_NONBLOCK pipe return
+// EAGAIN instead of waiting.
+void
+nonblocktest(char *s)
+{
+  int fds[2], n, tot;
+  char c;
+
+  if(pipe2(fds, O_NONBLOCK) != 0){
+    printf("%s: pipe2() failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], &c, 1) != EAGAIN){
+    printf("%s: read of an empty pipe didn't return EAGAIN\n", s);
+    exit(1);
+  }
+  for(tot = 0; (n = write(fds[1], buf, sizeof(buf))) > 0; tot += n)
+    if(tot > 1024*1024)
+      break;
+  if(n != EAGAIN || tot == 0){
+    printf("%s: write to a full pipe returned %d after %d\n", s, n, tot);
+    exit(1);
+  }
+  if(read(fds[0], &c, 1) != 1 || write(fds[1], "x", 1) != 1){
+    printf("%s: pipe I/O after EAGAIN failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK) ||
+     fcntl(fds[1], F_SETFL, 0) != 0 || fcntl(fds[1], F_GETFL, 0) != O_WRONLY){
+    printf("%s: F_GETFL/F_SETFL failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  if(write(fds[1], "x", 1) != -1){
+    printf("%s: write to a closed pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+}
+
+// splice a file into a pipe, tee that pipe into another,
+// and splice the first pipe back out to a second file.
+void
+splicetest(char *s)
+{
+  int fd, out, p[2], q[2], i, n;
+  enum { N=3000 };
+
+  unlink("splice1");
+  unlink("splice2");
+  fd = open("splice1", O_CREATE|O_RDWR);
+  out = open("splice2", O_CREATE|O_RDWR);
+  if(fd < 0 || out < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    buf[i] = i * 7;
+  if(write(fd, buf, N) != N){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(splice(fd, out, N) != -1){
+    printf("%s: spliced file to file\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("splice1", O_RDONLY);
+  if(pipe(p) != 0 || pipe(q) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if((n = splice(fd, p[1], N + 100)) != N){
+    printf("%s: splice from file moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, p[1], 100) != 0){
+    printf("%s: splice past end of file\n", s);
+    exit(1);
+  }
+  if((n = tee(p[0], q[1], N)) != N){
+    printf("%s: tee copied %d\n", s, n);
+    exit(1);
+  }
+  if((n = splice(p[0], out, N)) != N){
+    printf("%s: splice to file moved %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  close(out);
+  close(p[0]);
+  close(p[1]);
+  close(q[1]);
+
+  memset(buf, 0, N);
+  if((n = read(q[0], buf, sizeof(buf))) != N){
+    printf("%s: read %d from tee'd pipe\n", s, n);
+    exit(1);
+  }
+  close(q[0]);
+  for(i = 0; i < N; i++){
+    if(buf[i] != (char)(i * 7)){
+      printf("%s: wrong data from tee'd pipe\n", s);
+      exit(1);
+    }
+  }
+  memset(buf, 0, N);
+  fd = open("splice2", O_RDONLY);
+  if((n = read(fd, buf, sizeof(buf))) != N){
+    printf("%s: read %d from spliced file\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    if(buf[i] != (char)(i * 7)){
+      printf("%s: wrong data in spliced file\n", s);
+      exit(1);
+    }
+  }
+  unlink("splice1");
+  unlink("splice2");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -655,6 +1216,54 @@ mem(char *s)
   }
 }
 
+// mix small and large allocations, check that none
+// overlap, and that freeing everything gives the
+// memory back to the kernel.
+void
+mallocmix(char *s)
+{
+  enum { N = 400 };
+  char *p[N];
+  uint sz[N];
+  char *top0;
+  int i, j;
+
+  top0 = sbrk(0);
+  for(i = 0; i < N; i++){
+    sz[i] = (i % 7 == 0) ? 3000 + i*37 : 1 + (i*13) % 900;
+    if((p[i] = malloc(sz[i])) == 0){
+      printf("%s: malloc(%d) failed\n", s, sz[i]);
+      exit(1);
+    }
+    if((uint64)p[i] % 16 != 0){
+      printf("%s: misaligned malloc %p\n", s, p[i]);
+      exit(1);
+    }
+    memset(p[i], i & 0xff, sz[i]);
+  }
+  // free every other one, then reallocate them.
+  for(i = 0; i < N; i += 2)
+    free(p[i]);
+  for(i = 0; i < N; i += 2){
+    p[i] = malloc(sz[i]);
+    memset(p[i], i & 0xff, sz[i]);
+  }
+  for(i = 0; i < N; i++){
+    for(j = 0; j < sz[i]; j++){
+      if(p[i][j] != (char)(i & 0xff)){
+        printf("%s: allocation %d was overwritten\n", s, i);
+        exit(1);
+      }
+    }
+  }
+  for(i = 0; i < N; i++)
+    free(p[i]);
+  if(sbrk(0) - top0 > 64*PGSIZE){
+    printf("%s: heap still %d bytes bigger after free\n", s, sbrk(0) - top0);
+    exit(1);
+  }
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -1678,6 +2287,281 @@ sbrkmuch(char *s)
   }
 }
 
+// exec() reads a program's pages in on first touch. the
+// kernel copies to a pipe reader's buffer and to wait()'s
+// status with locks held, so it must fault pages of this
+// untouched array in beforehand.
+static char lazybuf[4*4096];
+
+void
+demandpage(char *s)
+{
+  int fds[2], pid, *status;
+  char *b;
+
+  b = lazybuf + 4096;
+  status = (int*)(lazybuf + 3*4096);
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "demand", 7) != 7 || read(fds[0], b, 7) != 7 || strcmp(b, "demand") != 0){
+    printf("%s: pipe read into untouched page failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(7);
+  if(wait(status) != pid || *status != 7){
+    printf("%s: wait status into untouched page failed\n", s);
+    exit(1);
+  }
+}
+
+// program text is shared read-only among the processes
+// running the program: neither a store nor the kernel may
+// write to it.
+void
+textwrite(char *s)
+{
+  int fds[2], pid, xstatus;
+  volatile int *text = (int*)textwrite;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], (char*)text, 1) != -1){
+    printf("%s: read() into text succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    *text = 10;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: store to text wasn't killed\n", s);
+    exit(1);
+  }
+}
+
+#define NTHR   3
+#define NINCR  100000
+
+static char thrstack[NTHR][4096];
+static int thrcount[NTHR];
+static int thrtotal;
+
+static void
+thrincr(void *arg)
+{
+  int i, *mine = arg;
+
+  for(i = 0; i < NINCR; i++){
+    (*mine)++;
+    __sync_fetch_and_add(&thrtotal, 1);
+  }
+}
+
+static void
+threxit(void *arg)
+{
+  exit(7);
+}
+
+static void
+thrspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// clone()d threads share memory with the process, and
+// join() collects them; exit() from any thread ends the
+// whole process, and exec() ends the other threads.
+void
+threads(char *s)
+{
+  int i, pid, xstatus, tid[NTHR];
+
+  for(i = 0; i < NTHR; i++){
+    if((tid[i] = thread_start(thrincr, &thrcount[i], thrstack[i], sizeof(thrstack[i]))) < 0){
+      printf("%s: thread_start failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NTHR; i++){
+    if(join(tid[i], &xstatus) != 0 || xstatus != 0){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+  }
+  if(join(tid[0], 0) != -1){
+    printf("%s: joined a thread twice\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NTHR; i++){
+    if(thrcount[i] != NINCR){
+      printf("%s: thread %d counted %d\n", s, i, thrcount[i]);
+      exit(1);
+    }
+  }
+  if(thrtotal != NTHR*NINCR){
+    printf("%s: total %d, not %d\n", s, thrtotal, NTHR*NINCR);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    thread_start(threxit, 0, thrstack[0], sizeof(thrstack[0]));
+    for(;;)
+      ;
+  }
+  wait(&xstatus);
+  if(xstatus != 7){
+    printf("%s: exit() from a thread gave status %d\n", s, xstatus);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    char *args[] = { "echo", 0 };
+    // one thread that runs forever, one that exits
+    // soon and is never joined.
+    thread_start(thrspin, 0, thrstack[0], sizeof(thrstack[0]));
+    thread_start(thrincr, &thrcount[1], thrstack[1], sizeof(thrstack[1]));
+    close(1);
+    exec("echo", args);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: exec() with threads failed\n", s);
+    exit(1);
+  }
+}
+
+static struct mutex lockedmu;
+static struct sem lockedsem;
+static int lockedcount;
+
+static void
+lockedincr(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NINCR; i++){
+    mutex_lock(&lockedmu);
+    lockedcount++;
+    mutex_unlock(&lockedmu);
+  }
+  sem_post(&lockedsem);
+}
+
+// threads increment a counter under a futex-based mutex,
+// and the main thread waits for them with a semaphore.
+void
+futextest(char *s)
+{
+  int i, tid[NTHR], word = 1;
+
+  if(futex_wait(&word, 0) != -1){
+    printf("%s: futex_wait slept on a changed word\n", s);
+    exit(1);
+  }
+  mutex_init(&lockedmu);
+  sem_init(&lockedsem, 0);
+  for(i = 0; i < NTHR; i++){
+    if((tid[i] = thread_start(lockedincr, 0, thrstack[i], sizeof(thrstack[i]))) < 0){
+      printf("%s: thread_start failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NTHR; i++)
+    sem_wait(&lockedsem);
+  if(lockedcount != NTHR*NINCR){
+    printf("%s: count %d, not %d\n", s, lockedcount, NTHR*NINCR);
+    exit(1);
+  }
+  for(i = 0; i < NTHR; i++)
+    join(tid[i], 0);
+}
+
+// grow by whole aligned megapages, check that fork copies
+// them, and that shrinking into the middle of one keeps the
+// rest of it.
+void
+megapages(char *s)
+{
+  char *top0, *a;
+  uint64 i, n;
+  int pid, xstatus;
+
+  top0 = sbrk(0);
+  if(sbrk(SUPERPGSIZE - (uint64)top0 % SUPERPGSIZE) == (char*)-1 ||
+     (a = sbrk(3*SUPERPGSIZE)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*SUPERPGSIZE; i += PGSIZE)
+    a[i] = i / PGSIZE;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < 3*SUPERPGSIZE; i += PGSIZE)
+      if(a[i] != (char)(i / PGSIZE))
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+
+  // drop the last megapage and half of the one before it.
+  if(sbrk(-(SUPERPGSIZE + SUPERPGSIZE/2)) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  n = 2*SUPERPGSIZE - SUPERPGSIZE/2;
+  for(i = 0; i < n; i += PGSIZE){
+    if(a[i] != (char)(i / PGSIZE)){
+      printf("%s: wrong data at %p after shrink\n", s, a + i);
+      exit(1);
+    }
+  }
+  sbrk(-(sbrk(0) - top0));
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2148,6 +3032,11 @@ main(int argc, char *argv[])
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
+    {megapages, "megapages"},
+    {demandpage, "demandpage"},
+    {textwrite, "textwrite"},
+    {threads, "threads"},
+    {futextest, "futextest"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
@@ -2161,7 +3050,17 @@ main(int argc, char *argv[])
     {exitiputtest, "exitiput"},
     {iputtest, "iput"},
     {mem, "mem"},
+    {mallocmix, "mallocmix"},
     {pipe1, "pipe1"},
+    {pipesize, "pipesize"},
+    {splicetest, "splicetest"},
+    {polltest, "polltest"},
+    {nonblocktest, "nonblocktest"},
+    {writevtest, "writevtest"},
+    {preadtest, "preadtest"},
+    {copytest, "copytest"},
+    {uringtest, "uringtest"},
+    {synctest, "synctest"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
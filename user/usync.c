@@ -0,0 +1,118 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Mutexes, condition variables and semaphores for threads
+// (thread_start()), built on atomic instructions and the
+// kernel's futexes. A thread enters the kernel only to wait,
+// or to wake a thread that is waiting.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+// After Drepper, "Futexes Are Tricky": state 2 means a
+// thread may be waiting, so mutex_unlock() must wake one.
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+// Returns 1 if m was locked, 0 if it was already held.
+int
+mutex_trylock(struct mutex *m)
+{
+  return __sync_bool_compare_and_swap(&m->state, 0, 1);
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+  c->nwait = 0;
+}
+
+// Release m, wait for cond_signal() or cond_broadcast(),
+// and lock m again. May return early, so callers recheck
+// their condition in a loop.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq;
+
+  __sync_fetch_and_add(&c->nwait, 1);
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  __sync_fetch_and_sub(&c->nwait, 1);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->nwait > 0)
+    futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->nwait > 0)
+    futex_wake(&c->seq, c->nwait);
+}
+
+void
+sem_init(struct sem *s, int count)
+{
+  s->count = count;
+  s->nwait = 0;
+}
+
+void
+sem_wait(struct sem *s)
+{
+  int n;
+
+  for(;;){
+    n = s->count;
+    if(n > 0){
+      if(__sync_bool_compare_and_swap(&s->count, n, n - 1))
+        return;
+      continue;
+    }
+    __sync_fetch_and_add(&s->nwait, 1);
+    futex_wait(&s->count, 0);
+    __sync_fetch_and_sub(&s->nwait, 1);
+  }
+}
+
+void
+sem_post(struct sem *s)
+{
+  __sync_fetch_and_add(&s->count, 1);
+  if(s->nwait > 0)
+    futex_wake(&s->count, 1);
+}
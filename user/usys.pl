@@ -37,3 +37,25 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("ntas");
+entry("bdbench");
+entry("fcntl");
+entry("splice");
+entry("tee");
+entry("dmesg");
+entry("clone");
+entry("texit");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("poll");
+entry("pipe2");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("lseek");
+entry("copy_file_range");
+entry("uring_setup");
+entry("uring_enter");
+entry("fsync");
+entry("sync");